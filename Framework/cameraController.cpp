@@ -52,4 +52,17 @@ void CameraController::update(std::shared_ptr<tga::Interface> const& tgai, tga::
 
 tga::Buffer CameraController::getCameraUB() const { return cameraUB; }
 
-const Camera& CameraController::getCamera() const { return camera; }
\ No newline at end of file
+const Camera& CameraController::getCamera() const { return camera; }
+
+std::array<glm::vec4, 6> CameraController::getFrustumPlanes() const
+{
+    // Rows of the view projection, a point is inside if -w <= x, y <= w and 0 <= z <= w
+    glm::mat4 viewProjection = camera.projection * camera.view;
+    auto row = [&](int i) {
+        return glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+    };
+    std::array<glm::vec4, 6> planes{row(3) + row(0), row(3) - row(0), row(3) + row(1),
+                                    row(3) - row(1), row(2),          row(3) - row(2)};
+    for (auto& plane : planes) plane /= glm::length(glm::vec3(plane));
+    return planes;
+}
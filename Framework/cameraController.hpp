@@ -1,4 +1,6 @@
 #pragma once
+#include <array>
+
 #include "glm/gtx/string_cast.hpp"
 #include "shaderData.hpp"
 #include "tga/tga_math.hpp"
@@ -12,6 +14,10 @@ public:
     const Camera& getCamera() const;
     tga::Buffer getCameraUB() const;
 
+    // The four side planes, the near and the far plane of the view frustum in world space. Normals point inwards and
+    // have unit length
+    std::array<glm::vec4, 6> getFrustumPlanes() const;
+
     float fov;
     float aspectRatio;
     float nearPlane;
@@ -1,11 +1,20 @@
 #pragma once
+#include <atomic>
 #include <chrono>
+#include <cstring>
+#include <exception>
 #include <filesystem>
 #include <random>
+#include <thread>
+#include <utility>
 
 #include "cameraController.hpp"
+#include "jobSystem.hpp"
 #include "glm/gtx/string_cast.hpp"
+#include "sceneGraph.hpp"
 #include "shaderData.hpp"
+#include "terrainQuadtree.hpp"
+#include "tripleBuffer.hpp"
 #include "tga/tga.hpp"
 #include "tga/tga_math.hpp"
 #include "tga/tga_utils.hpp"
@@ -14,7 +23,21 @@ using namespace glm;
 using namespace std;
 using namespace tga;
 
+/**
+ * @brief Row-major height field, optionally surrounded by an apron
+ *
+ * The apron is a frame of `border` texels around the map. Once fillBorder() copied the edges into it, kernels that read
+ * up to `border` texels beyond the edge can use the unchecked accessors for every texel, without modulo or branches.
+ */
 struct Heightmap {
+    enum class Edge {
+        wrap, /**<The apron continues the opposite side, for tileable maps*/
+        clamp /**<The apron repeats the outermost texel*/
+    };
+
+    Heightmap() = default;
+    Heightmap(int width, int height, int border = 0);
+
     /**
      * @brief Save access with wrapping behavior
      *
@@ -24,27 +47,70 @@ struct Heightmap {
      */
     float& at(int x, int y);
 
+    // Unchecked access, x and y may reach up to `border` texels beyond the edges
+    float& operator()(int x, int y) { return data[offset(x, y)]; }
+    float operator()(int x, int y) const { return data[offset(x, y)]; }
+    // Start of row y, the row continues `border` texels to the left and to the right
+    float* row(int y) { return data.data() + offset(0, y); }
+    float const* row(int y) const { return data.data() + offset(0, y); }
+    // Distance between two rows in texels
+    size_t stride() const { return size_t(width) + 2 * border; }
+
+    /**
+     * @brief Copies the edges into the apron, call it after the map changed
+     *
+     */
+    void fillBorder(Edge edge);
+
     /**
      * @brief Remaps the values in the heightmap to the rango zero to one
      *
      */
     void normalize();
 
-    int width, height;
-    std::vector<float> data;
+    /**
+     * @brief The map without the apron, rows packed tightly
+     *
+     */
+    std::vector<float> packed() const;
+
+    int width = 0, height = 0;
+    int border = 0;
+    std::vector<float> data;  // stride() * (height + 2 * border) values
+
+private:
+    size_t offset(int x, int y) const { return size_t(y + border) * stride() + size_t(x + border); }
 };
 
+/**
+ * @brief Counter-based normal distributed noise
+ *
+ * Every sample is a pure function of the seed and its address (x, y, level), so samples can be drawn in any order and
+ * on any thread and always come out the same.
+ */
 class RNG {
 public:
     RNG();
     RNG(uint32_t seed);
 
     /**
-     * @brief receive a random float between -1 and 1
+     * @brief receive a random float, normal distributed with a sigma of .5, so roughly between -1.5 and 1.5
      *
      */
     float getFloat();
 
+    /**
+     * @brief The sample at (x, y) of the given level, same distribution as getFloat()
+     *
+     */
+    float getFloat(int x, int y, int level) const;
+
+    /**
+     * @brief Batch version of getFloat(x, y, level) for the points firstX, firstX + stepX, ... of row y
+     *
+     */
+    void fillNormal(float* values, size_t count, int firstX, int y, int level, int stepX = 1) const;
+
     /**
      * @brief Set the seed of the generator
      *
@@ -57,9 +123,8 @@ public:
     uint32_t getSeed();
 
 private:
-    std::random_device rd;
     uint32_t seed;
-    std::mt19937 generator;
+    uint64_t counter = 0;  // Position of getFloat() in its stream
 };
 
 class DiamondSquare {
@@ -71,8 +136,9 @@ public:
      * @param wrap Whether the heightmap can be tiled
      * @param featureSizeRatio Decreases the feature size for wrapped implementation
      * @param seed Seed for the random number generator
+     * @param jobs Splits every pass into row bands if given, the result only depends on the seed, not on the threads
      */
-    DiamondSquare(int n, bool wrap = false, int featureSizeRatio = 1, uint32_t seed = 0);
+    DiamondSquare(int n, bool wrap = false, int featureSizeRatio = 1, uint32_t seed = 0, JobSystem* jobs = nullptr);
 
     /**
      * @brief Returns the reference to the generated heightmap
@@ -82,23 +148,50 @@ public:
 
 private:
     RNG rng;
+    JobSystem* jobs;
     Heightmap heightmap;
 
-    void diamondStep(int x, int y, int stepsize, double scale);
-    void squareStep(int x, int y, int stepsize, double scale);
+    // Noise of the points firstX, firstX + step, ... of row y
+    void fillNoise(float* noise, int count, int firstX, int y, int step, float scale) const;
+    // Calls band(first, last) for bands of [0, rowCount), in parallel if there are jobs
+    void forEachBand(int rowCount, int pointsPerRow, std::function<void(int, int)> const& band);
     void generate(int n);
 
     // Alternative Implementation
-    void diamondStepWrapped(int x, int y, int stepsize, double scale);
-    void squareStepWrapped(int x, int y, int stepsize, double scale);
     void generateWrapped(int n, int featureSizeRatio);
 };
 
-HDRImage generateMipMap(HDRImage image);
-HDRImage createMipMap(HDRImage image, int mipLevel);
-vector<float> createHeightmap(int size);
+// Next smaller level of the image, box filtered
+HDRImage generateMipMap(HDRImage const& image);
+// Level mipLevel of the image, 0 is the image itself
+HDRImage createMipMap(HDRImage const& image, int mipLevel);
+Heightmap createHeightmap(int size, JobSystem* jobs = nullptr);
+
+/**
+ * @brief Two component encodings of generateNormalMap, both fit Format::r8g8_snorm
+ */
+enum class NormalEncoding {
+    octahedral, /**<Octahedral mapping, the most even precision over all directions*/
+    hemisphere  /**<x and y of the normal, z = sqrt(1 - x^2 - y^2) since height field normals always point up*/
+};
 
-vector<vec3> generateNormalMap(vector<float> source, int length);
+/**
+ * @brief Normals of the height field spanning [-1, 1]^2 with heights in [0, 1], z up
+ *
+ * Central differences read one texel beyond the edges, so the heightmap needs an apron filled by fillBorder(). Rows
+ * are split across the jobs if given.
+ *
+ * @param normals Output of width * height normals, row by row
+ */
+void generateNormalMap(Heightmap const& heightmap, vec3* normals, JobSystem* jobs = nullptr);
+/**
+ * @brief Same as above, quantized for direct upload
+ *
+ * @param texels Output of 2 * width * height signed bytes, row by row
+ */
+void generateNormalMap(Heightmap const& heightmap, NormalEncoding encoding, int8_t* texels,
+                       JobSystem* jobs = nullptr);
+vector<vec3> generateNormalMap(Heightmap const& heightmap, JobSystem* jobs = nullptr);
 vector<uint8_t> convertNormalMap(vector<vec3> source);
 vector<float> convertToFloats(vector<vec3> source);
 
@@ -107,6 +200,7 @@ public:
     // Override these
     virtual void OnCreate() {}       // Create Stuff here
     virtual void OnFixedUpdate() {}  // Gets called every fixedTimestep (default 60 times a seconds)
+                                     // With simulationThread it runs on its own thread, concurrently to OnUpdate
     virtual void OnUpdate(uint32_t backbufferIndex) { (void)backbufferIndex; }  // Gets called every frame
     virtual void OnDestroy() {}  // Gets called when it's time to delete stuff
 
@@ -116,12 +210,17 @@ protected:
     double fixedTimestep;      // Time between two calls to OnFixedUpdate()
     double totalElapsedTime;   // Total Time since the call to run()
     uint64_t totalFrameCount;  // Number of frames rendered so far
+    double simulationTime = 0; // Time of the current OnFixedUpdate, only touch it from OnFixedUpdate
+    bool simulationThread = false;  // Set it in OnCreate at the latest, OnFixedUpdate and OnUpdate then must only
+                                    // share data through a TripleBuffer
 
     std::shared_ptr<tga::Interface> tgai;  // Interface to TGA
+    tga::AssetCache assets;                // Loads textures, shaders and objs once, see tga::AssetCache
     glm::uvec2 frameworkWindowResolution;  // The resolution of the framework window
     tga::Window frameworkWindow;           // The window managed by the framework
 
     std::unique_ptr<CameraController> camController;  // A simple first person camera controller
+    JobSystem jobs;  // Fans work out over all cores, see JobSystem::run and JobSystem::parallelFor
 
     bool sunMovement = true;  // Deactivating this will stop the update and movement of the sun
 
@@ -134,12 +233,6 @@ protected:
                                         {{camController->getCameraUB(), 0}, {lightUB, 1}, {systemUB, 2}}  // What we want to bind
                                     });
     }
-    struct Vertex {
-        vec3 position;
-        vec3 normal;
-        vec2 texcoord;
-    };
-
     struct BoundingSphere {
         float radius;
         vec4 center;
@@ -152,71 +245,52 @@ protected:
         alignas(16) vec3 dimensions;
         alignas(4) float height;
     };
-    Buffer vertexBuffer;
-    Buffer indexBuffer;
     Buffer uniformBuffer;
     Buffer textureBuffer;
     //object
-    Buffer meshVertexBuffer;
-    Buffer meshIndexBuffer;
     Buffer meshUniformBuffer;
-    // gatling
-    Buffer meshVertexBufferGatling;
-    Buffer meshIndexBufferGatling;
-    Buffer meshUniformBufferGatling;
-    Buffer meshVertexBufferGatlingBase;
-    Buffer meshIndexBufferGatlingBase;
-    Buffer meshUniformBufferGatlingBase;
-    //plasma
-    Buffer meshVertexBufferPlasma;
-    Buffer meshIndexBufferPlasma;
-    Buffer meshUniformBufferPlasma;
-    Buffer meshVertexBufferPlasmaBase;
-    Buffer meshIndexBufferPlasmaBase;
-    Buffer meshUniformBufferPlasmaBase;
-
-    tga::Obj enemy;
-    Buffer enemyVertex;
-    Buffer enemyIndex;
-
-    vector<float> heightmap;
-    vector<vec3> normalmap;
-    vector<Vertex> vertices;
-    vector<int> index;
+
+    std::shared_ptr<tga::Obj const> enemy;
+
+    // All meshes share one vertex and one index buffer
+    tga::MeshArena<tga::PackedVertex> meshArena;
+    tga::MeshRange enemyRange;
+    tga::MeshRange cockpitRange;
+    tga::MeshRange gatlingRange;
+    tga::MeshRange gatlingBaseRange;
+    tga::MeshRange plasmaRange;
+    tga::MeshRange plasmaBaseRange;
+    tga::DrawBatch meshBatch;  // Cockpit and guns
+
+    Heightmap heightmap;  // One texel apron with clamped edges
     TerrainData uniformTerrain;
     string pathToTheTexture = "resources/Surface_Textures/gras15.png";
     InputSet actualInputSet;
     InputSet textureInputSet;
     InputSet meshInputSet;
-    InputSet meshInputSetGatling;
-    InputSet meshInputSetPlasma;
-    Buffer meshCockpitUniformBuffer;
 
-    tga::Obj mesh;
-    tga::Obj meshGunGatling;
-    tga::Obj meshGunGatlingBase;
-    tga::Obj meshGunPlasma;
-    tga::Obj meshGunPlasmaBase;
+    std::shared_ptr<tga::Obj const> mesh;
+    std::shared_ptr<tga::Obj const> meshGunGatling;
+    std::shared_ptr<tga::Obj const> meshGunGatlingBase;
+    std::shared_ptr<tga::Obj const> meshGunPlasma;
+    std::shared_ptr<tga::Obj const> meshGunPlasmaBase;
 
     Buffer vertexBufferGuns;
     Buffer indexBufferGuns;
 
-    Buffer matrixBuffer;
-    Buffer matrixBufferGatling;
-    Buffer matrixBufferPlasma;
-
-    vector<Vertex> createVertexBuffer(vector<float> heightmap, vector<vec3> normalmap);
-    vector<int> createIndexBuffer(vector<Vertex> vertices);
-    TerrainData createTerrainUniformBuffer(vector<float> heightmap);
+    TerrainData createTerrainUniformBuffer(Heightmap const& heightmap);
 
 public:
     Framework()
         : deltaTime(1. / 60.), fixedTimestep(1. / 60.), totalElapsedTime(0), totalFrameCount(0),
-          tgai(std::make_shared<tga::TGAVulkan>())
+          tgai(std::make_shared<tga::TGAVulkan>()), assets(tgai)
     {}
 
     // Call this to start the framework, ignore everything further down
-    void run(glm::uvec2 resolution = glm::uvec2(0), tga::PresentMode presentMode = tga::PresentMode::vsync)
+    // targetFrameRate caps the frames per second (0 = uncapped), maxQueuedFrames limits how many finished frames may
+    // wait for the monitor (0 = minimum of the driver), fewer frames lower the input latency
+    void run(glm::uvec2 resolution = glm::uvec2(0), tga::PresentMode presentMode = tga::PresentMode::vsync,
+             double targetFrameRate = 0, uint32_t maxQueuedFrames = 0)
     {
         using namespace std::chrono_literals;
 
@@ -225,7 +299,10 @@ public:
             resolution = {wx, wy};
         }
         frameworkWindowResolution = resolution;
-        frameworkWindow = tgai->createWindow({frameworkWindowResolution.x, frameworkWindowResolution.y, presentMode});
+        // The frame being rendered takes one backbuffer, the others can be queued
+        uint32_t backbufferCount = maxQueuedFrames ? maxQueuedFrames + 1 : 0;
+        frameworkWindow = tgai->createWindow(
+            {frameworkWindowResolution.x, frameworkWindowResolution.y, presentMode, backbufferCount});
 
         camController = std::make_unique<CameraController>(
             90., frameworkWindowResolution.x / float(frameworkWindowResolution.y), 0.1, 5000.);
@@ -233,15 +310,46 @@ public:
         updateSystemBuffers();
         OnCreate();
 
-        static double accumulator = 0;
         auto beginTime = std::chrono::steady_clock::now();
+        auto frameDeadline = beginTime;
+        if (simulationThread) startSimulation();
+        try {
+            renderLoop(beginTime, frameDeadline, targetFrameRate);
+        } catch (...) {
+            stopSimulation();
+            throw;
+        }
+        stopSimulation();
+        // The loop also ends when the simulation threw, the exception leaves run() like in the single threaded case
+        if (simulationError) std::rethrow_exception(std::exchange(simulationError, nullptr));
 
+        OnDestroy();
+        tgai->free(camController->getCameraUB());
+        tgai->free(systemUB);
+        tgai->free(lightUB);
+        tgai->free(frameworkWindow);
+    }
+
+    /* Ignore this part unless you want to do some fancy stuff*/
+
+protected:
+    void renderLoop(std::chrono::steady_clock::time_point beginTime,
+                    std::chrono::steady_clock::time_point frameDeadline, double targetFrameRate)
+    {
         while (!tgai->windowShouldClose(frameworkWindow)) {
-            accumulator += deltaTime;
-            while (accumulator >= fixedTimestep) {
+            // The simulation only stops by itself when OnFixedUpdate threw
+            if (simulationThread && !simulationRunning.load(std::memory_order_acquire)) return;
+            if (targetFrameRate > 0) limitFrameRate(frameDeadline, targetFrameRate);
+            if (simulationThread) {
                 tgai->pollEvents(frameworkWindow);
-                OnFixedUpdate();
-                accumulator -= fixedTimestep;
+            } else {
+                accumulator += deltaTime;
+                while (accumulator >= fixedTimestep) {
+                    tgai->pollEvents(frameworkWindow);
+                    simulationTime += fixedTimestep;
+                    OnFixedUpdate();
+                    accumulator -= fixedTimestep;
+                }
             }
             auto nextFrame = tgai->nextFrame(frameworkWindow);
             camController->update(tgai, frameworkWindow, deltaTime);
@@ -255,17 +363,60 @@ public:
             totalElapsedTime += deltaTime;
             totalFrameCount++;
         }
+    }
 
-        OnDestroy();
-        tgai->free(camController->getCameraUB());
-        tgai->free(systemUB);
-        tgai->free(lightUB);
-        tgai->free(frameworkWindow);
+    /**
+     * @brief Ticks OnFixedUpdate in real time, a slow tick is caught up by the following ones
+     *
+     * After a longer stall at most maxCatchUpTicks are caught up, the rest of the time is dropped. An exception of
+     * OnFixedUpdate stops the simulation and is rethrown by run().
+     */
+    void startSimulation()
+    {
+        simulationRunning = true;
+        simulation = std::thread([this] {
+            constexpr int maxCatchUpTicks = 4;
+            auto step = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(fixedTimestep));
+            auto nextTick = std::chrono::steady_clock::now();
+            try {
+                while (simulationRunning.load(std::memory_order_relaxed)) {
+                    simulationTime += fixedTimestep;
+                    OnFixedUpdate();
+                    nextTick = std::max(nextTick + step, std::chrono::steady_clock::now() - maxCatchUpTicks * step);
+                    std::this_thread::sleep_until(nextTick);
+                }
+            } catch (...) {
+                simulationError = std::current_exception();
+                // Publishes the error to the render loop
+                simulationRunning.store(false, std::memory_order_release);
+            }
+        });
     }
 
-    /* Ignore this part unless you want to do some fancy stuff*/
+    void stopSimulation()
+    {
+        simulationRunning = false;
+        if (simulation.joinable()) simulation.join();
+    }
+
+    // Sleeps through most of the frame and spins the rest, sleeping alone overshoots by up to a scheduler tick
+    static void limitFrameRate(std::chrono::steady_clock::time_point& deadline, double targetFrameRate)
+    {
+        using namespace std::chrono_literals;
+        constexpr auto spinTime = 2ms;
+        deadline += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(1. / targetFrameRate));
+        auto now = std::chrono::steady_clock::now();
+        // A late frame starts right away and doesn't make the following ones hurry
+        if (deadline <= now) {
+            deadline = now;
+            return;
+        }
+        if (deadline - now > spinTime) std::this_thread::sleep_for(deadline - now - spinTime);
+        while (std::chrono::steady_clock::now() < deadline) std::this_thread::yield();
+    }
 
-protected:
     void updateSystemBuffers()
     {
         // Light Data
@@ -297,6 +448,10 @@ protected:
     }
 
     // Those are managed for you
+    double accumulator = 0;
+    std::thread simulation;
+    std::atomic<bool> simulationRunning{false};
+    std::exception_ptr simulationError;  // Written by the simulation thread before it stops
     SystemData systemData;
     Light light;
     tga::Buffer systemUB, lightUB;
@@ -0,0 +1,140 @@
+#include "jobSystem.hpp"
+
+namespace
+{
+    // Queue of the calling thread, threads that are not workers share the queue of the creating thread
+    thread_local JobSystem const* workerSystem = nullptr;
+    thread_local uint32_t workerQueue = 0;
+}  // namespace
+
+JobSystem::JobSystem(uint32_t workerCount)
+{
+    for (uint32_t i = 0; i <= workerCount; i++) queues.emplace_back(std::make_unique<Queue>());
+    for (uint32_t i = 1; i <= workerCount; i++) workers.emplace_back(&JobSystem::workerLoop, this, i);
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wakeWorkers.notify_all();
+    for (auto& worker : workers) worker.join();
+}
+
+void JobSystem::run(Job job, Counter* counter, Counter* dependency)
+{
+    if (counter) counter->pending.fetch_add(1, std::memory_order_relaxed);
+    if (dependency) {
+        std::lock_guard<std::mutex> lock(dependency->mutex);
+        if (dependency->pending.load(std::memory_order_acquire) != 0) {
+            dependency->continuations.emplace_back(std::move(job), counter);
+            return;
+        }
+    }
+    enqueue(std::move(job), counter);
+}
+
+void JobSystem::wait(Counter& counter)
+{
+    while (!counter.done()) {
+        if (!executeOne(currentQueue())) std::this_thread::yield();
+    }
+    // The last job may still hold the lock, the counter must not go away before it lets go
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> lock(counter.mutex);
+        std::swap(error, counter.error);
+    }
+    if (!error) {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        std::swap(error, unclaimedError);
+    }
+    if (error) std::rethrow_exception(error);
+}
+
+void JobSystem::enqueue(Job job, Counter* counter)
+{
+    auto& queue = *queues[currentQueue()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.jobs.emplace_back(std::move(job), counter);
+    }
+    queuedJobs.fetch_add(1, std::memory_order_release);
+    // Taking the lock orders the increment before a worker that is about to sleep checks it
+    { std::lock_guard<std::mutex> lock(sleepMutex); }
+    wakeWorkers.notify_one();
+}
+
+bool JobSystem::executeOne(uint32_t queueIndex)
+{
+    std::pair<Job, Counter*> entry;
+    bool found = false;
+    // Newest job of the own queue first, it is most likely still in the cache
+    {
+        auto& own = *queues[queueIndex];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.jobs.empty()) {
+            entry = std::move(own.jobs.back());
+            own.jobs.pop_back();
+            found = true;
+        }
+    }
+    // Otherwise the oldest job of another queue, which tends to be the largest piece of work
+    for (uint32_t i = 1; !found && i < queues.size(); i++) {
+        auto& victim = *queues[(queueIndex + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty()) {
+            entry = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+            found = true;
+        }
+    }
+    if (!found) return false;
+    queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+
+    std::exception_ptr error;
+    try {
+        entry.first();
+    } catch (...) {
+        error = std::current_exception();
+    }
+    finish(entry.second, error);
+    return true;
+}
+
+void JobSystem::finish(Counter* counter, std::exception_ptr error)
+{
+    if (!counter) {
+        // Nobody waits for the job, the next wait() reports its exception
+        if (error) {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (!unclaimedError) unclaimedError = error;
+        }
+        return;
+    }
+    std::vector<std::pair<Job, Counter*>> continuations;
+    {
+        std::lock_guard<std::mutex> lock(counter->mutex);
+        if (error && !counter->error) counter->error = error;
+        if (counter->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            std::swap(continuations, counter->continuations);
+    }
+    // The counter may be gone from here on
+    for (auto& [job, jobCounter] : continuations) enqueue(std::move(job), jobCounter);
+}
+
+void JobSystem::workerLoop(uint32_t queueIndex)
+{
+    workerSystem = this;
+    workerQueue = queueIndex;
+    while (true) {
+        if (executeOne(queueIndex)) continue;
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wakeWorkers.wait(lock, [this] { return stopping || queuedJobs.load(std::memory_order_acquire) > 0; });
+        if (stopping && queuedJobs.load(std::memory_order_acquire) == 0) return;
+    }
+}
+
+uint32_t JobSystem::currentQueue() const { return workerSystem == this ? workerQueue : 0; }
@@ -0,0 +1,142 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Work-stealing job scheduler
+ *
+ * Every worker and the thread that created the JobSystem own a deque. Jobs are pushed to and popped from the back of
+ * the own deque, idle workers steal from the front of the others. Threads that wait for a Counter execute jobs in
+ * the meantime instead of blocking.
+ */
+class JobSystem {
+public:
+    using Job = std::function<void()>;
+
+    /**
+     * @brief Tracks a group of jobs, reaches zero once all of them are done
+     *
+     * Jobs can depend on a Counter, they are only queued once it reaches zero. A Counter must outlive its jobs and
+     * can be reused once it reached zero.
+     */
+    class Counter {
+    public:
+        bool done() const { return pending.load(std::memory_order_acquire) == 0; }
+
+    private:
+        friend class JobSystem;
+        std::atomic<uint32_t> pending{0};
+        std::mutex mutex;
+        std::vector<std::pair<Job, Counter*>> continuations;
+        std::exception_ptr error;
+    };
+
+    /**
+     * @brief Waits for a Counter when it goes out of scope, so jobs never outlive a Counter on the stack
+     *
+     * Meant for exits by an exception, the exceptions of the jobs are dropped here. The regular path calls wait().
+     */
+    class ScopedWait {
+    public:
+        ScopedWait(JobSystem& _jobs, Counter& _counter) : jobs(_jobs), counter(_counter) {}
+        ~ScopedWait()
+        {
+            if (counter.done()) return;
+            try {
+                jobs.wait(counter);
+            } catch (...) {
+            }
+        }
+        ScopedWait(ScopedWait const&) = delete;
+        ScopedWait& operator=(ScopedWait const&) = delete;
+
+    private:
+        JobSystem& jobs;
+        Counter& counter;
+    };
+
+    // Without an explicit count there is one worker per core besides the creating thread
+    explicit JobSystem(uint32_t workerCount = std::max(std::thread::hardware_concurrency(), 2u) - 1);
+    ~JobSystem();
+    JobSystem(JobSystem const&) = delete;
+    JobSystem& operator=(JobSystem const&) = delete;
+
+    /**
+     * @brief Queues a job
+     *
+     * @param counter Incremented now and decremented when the job is done, may be nullptr
+     * @param dependency The job is held back until this Counter reaches zero, may be nullptr
+     */
+    void run(Job job, Counter* counter = nullptr, Counter* dependency = nullptr);
+
+    /**
+     * @brief Executes queued jobs until the counter reaches zero
+     *
+     * Rethrows the first exception thrown by a job of the counter. Otherwise rethrows the first exception of a job
+     * without a counter that nobody saw yet.
+     */
+    void wait(Counter& counter);
+
+    /**
+     * @brief Calls body(first, last) on disjoint chunks of [begin, end) in parallel and waits for all of them
+     *
+     * @param grain Minimum number of elements per chunk, chunks should be worth more than a queue round trip
+     */
+    template <typename Body>
+    void parallelFor(size_t begin, size_t end, size_t grain, Body&& body)
+    {
+        if (begin >= end) return;
+        size_t count = end - begin;
+        // A few chunks per thread keep the load balanced when chunks take differently long
+        size_t chunks = std::clamp<size_t>(count / std::max<size_t>(grain, 1), 1, 4 * threadCount());
+        size_t chunkSize = (count + chunks - 1) / chunks;
+        Counter counter;
+        for (size_t first = begin + chunkSize; first < end; first += chunkSize) {
+            size_t last = std::min(first + chunkSize, end);
+            run([&body, first, last] { body(first, last); }, &counter);
+        }
+        // The calling thread takes the first chunk itself
+        std::exception_ptr error;
+        try {
+            body(begin, std::min(begin + chunkSize, end));
+        } catch (...) {
+            error = std::current_exception();
+        }
+        wait(counter);
+        if (error) std::rethrow_exception(error);
+    }
+
+    // Workers plus the creating thread
+    uint32_t threadCount() const { return uint32_t(queues.size()); }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::pair<Job, Counter*>> jobs;
+    };
+
+    void enqueue(Job job, Counter* counter);
+    bool executeOne(uint32_t queueIndex);
+    void finish(Counter* counter, std::exception_ptr error);
+    void workerLoop(uint32_t queueIndex);
+    uint32_t currentQueue() const;
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex sleepMutex;
+    std::condition_variable wakeWorkers;
+    std::atomic<uint32_t> queuedJobs{0};
+    std::atomic<bool> stopping{false};
+
+    std::mutex errorMutex;
+    std::exception_ptr unclaimedError;  // First exception of a job without a counter
+};
@@ -0,0 +1,51 @@
+#include "sceneGraph.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+SceneGraph::Node SceneGraph::add(glm::mat4 const& local, Node parent)
+{
+    Node node = size();
+    if (parent != none && (parent >= node || parent + subtreeSizes[parent] != node))
+        throw std::runtime_error("Scene graph nodes must be added depth first");
+    for (Node ancestor = parent; ancestor != none; ancestor = parents[ancestor]) subtreeSizes[ancestor]++;
+
+    parents.push_back(parent);
+    subtreeSizes.push_back(1);
+    locals.push_back(local);
+    worlds.push_back(local);
+    flagged.push_back(1);
+    dirty.push_back(node);
+    return node;
+}
+
+void SceneGraph::setLocal(Node node, glm::mat4 const& local)
+{
+    locals[node] = local;
+    if (flagged[node]) return;
+    flagged[node] = 1;
+    dirty.push_back(node);
+}
+
+std::vector<std::pair<SceneGraph::Node, SceneGraph::Node>> const& SceneGraph::update()
+{
+    changed.clear();
+    std::sort(dirty.begin(), dirty.end());
+    for (Node node : dirty) {
+        flagged[node] = 0;
+        // Subtrees are either nested or disjoint, so a node before the end of the last range lies inside of it
+        if (!changed.empty() && node < changed.back().second) continue;
+
+        Node last = node + subtreeSizes[node];
+        for (Node i = node; i < last; i++)
+            worlds[i] = parents[i] == none ? locals[i] : worlds[parents[i]] * locals[i];
+
+        // Neighbouring subtrees go out as one range
+        if (!changed.empty() && changed.back().second == node)
+            changed.back().second = last;
+        else
+            changed.emplace_back(node, last);
+    }
+    dirty.clear();
+    return changed;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "tga/tga_math.hpp"
+
+/**
+ * @brief Transform hierarchy stored as flat arrays in depth-first order
+ *
+ * A node is an index into the arrays, every subtree occupies the contiguous range [node, node + subtree size). So a
+ * parent is always stored before its children and update() recomputes a dirty subtree in one linear sweep without
+ * touching the rest of the scene. Nodes map 1:1 to instance slots, a GPU buffer with one entry per node can be kept
+ * up to date by uploading the ranges returned from update().
+ */
+class SceneGraph {
+public:
+    using Node = uint32_t;
+    static constexpr Node none = ~Node(0);
+
+    /**
+     * @brief Appends a node
+     *
+     * Nodes have to be added depth first, the parent must be the last added node or one of its ancestors.
+     */
+    Node add(glm::mat4 const& local, Node parent = none);
+
+    // Marks the node and everything below it for the next update()
+    void setLocal(Node node, glm::mat4 const& local);
+
+    glm::mat4 const& local(Node node) const { return locals[node]; }
+    glm::mat4 const& world(Node node) const { return worlds[node]; }
+    Node parent(Node node) const { return parents[node]; }
+    uint32_t size() const { return uint32_t(parents.size()); }
+
+    /**
+     * @brief Recomputes the world transforms of all dirty subtrees
+     *
+     * @return Ranges [first, last) of nodes whose world transform changed, sorted and not overlapping. Valid until the
+     * next call
+     */
+    std::vector<std::pair<Node, Node>> const& update();
+
+private:
+    std::vector<Node> parents;
+    std::vector<uint32_t> subtreeSizes;  // Including the node itself
+    std::vector<glm::mat4> locals;
+    std::vector<glm::mat4> worlds;
+    std::vector<uint8_t> flagged;  // Node is in dirty
+    std::vector<Node> dirty;
+    std::vector<std::pair<Node, Node>> changed;
+};
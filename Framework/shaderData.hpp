@@ -29,3 +29,15 @@ struct SystemData {
     alignas(8) glm::vec2 resolution;
     alignas(4) float time;
 };
+
+struct DrawData {
+    alignas(16) glm::mat4 transform;
+    alignas(4) uint32_t material;
+};
+
+// One terrain node drawn by terrain_proxy.vert, see TerrainQuadtree
+struct TerrainNode {
+    alignas(8) glm::vec2 origin;  // First texel of the node
+    alignas(4) float step;        // Texels per grid cell
+    alignas(8) glm::vec2 morph;   // Morph factor = clamp(morph.y * distance - morph.x, 0, 1)
+};
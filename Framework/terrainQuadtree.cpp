@@ -0,0 +1,191 @@
+#include "terrainQuadtree.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+    // Clears visible for the boxes entirely behind the plane
+    void cullPlane(glm::vec4 plane, size_t count, float const* __restrict centerX, float const* __restrict centerY,
+                   float const* __restrict centerZ, float const* __restrict extentX, float const* __restrict extentY,
+                   float const* __restrict extentZ, uint8_t* __restrict visible)
+    {
+        glm::vec3 normal(plane), reach = glm::abs(normal);
+        for (size_t i = 0; i < count; i++) {
+            float distance = normal.x * centerX[i] + normal.y * centerY[i] + normal.z * centerZ[i] + plane.w;
+            float radius = reach.x * extentX[i] + reach.y * extentY[i] + reach.z * extentZ[i];
+            visible[i] &= uint8_t(distance + radius >= 0);
+        }
+    }
+}  // namespace
+
+TerrainQuadtree::TerrainQuadtree(uint32_t _cells, uint32_t _gridCells, glm::vec3 const& _origin,
+                                 glm::vec3 const& _extent, float const* heights, size_t rowStride)
+    : cells(_cells), gridCells(_gridCells), origin(_origin), extent(_extent)
+{
+    if (gridCells == 0 || gridCells % 2 != 0 || gridVertexCount() > 65536)
+        throw std::runtime_error("Terrain quadtree grids need an even cell count and 16 bit indices");
+    uint32_t levelCount = 1;
+    while ((gridCells << (levelCount - 1)) < cells) levelCount++;
+    if ((gridCells << (levelCount - 1)) != cells)
+        throw std::runtime_error("Terrain quadtree cells must be the grid cells times a power of two");
+    ranges.resize(levelCount);
+    buildBounds(heights, rowStride);
+    // Until setScreenError is called: 90 degree field of view, 1080 pixels and two pixels of error
+    setScreenError(1.5707964f, 1080.f, 2.f);
+}
+
+void TerrainQuadtree::setScreenError(float fovY, float viewportHeight, float pixelError)
+{
+    // A cell of size s at distance d covers about s * pixelsPerUnit / d pixels
+    float pixelsPerUnit = viewportHeight / (2 * std::tan(fovY / 2));
+    float leafSpacing = std::max(extent.x, extent.z) / float(cells);
+    for (uint32_t lod = 0; lod < levels(); lod++) {
+        float spacing = leafSpacing * float(1u << lod);
+        // The morph needs the next level to start well outside of the node, so a range spans a few nodes at least
+        ranges[lod] = std::max(spacing * pixelsPerUnit / pixelError, 4.f * spacing * float(gridCells));
+    }
+    ranges.back() = std::numeric_limits<float>::max();
+}
+
+void TerrainQuadtree::buildBounds(float const* heights, size_t rowStride)
+{
+    // Leaves take the range of their texels including the shared edges, every other level that of its children
+    std::vector<float> low, high;
+    uint32_t leaves = cells / gridCells;
+    low.resize(size_t(leaves) * leaves);
+    high.resize(low.size());
+    for (uint32_t z = 0; z < leaves; z++)
+        for (uint32_t x = 0; x < leaves; x++) {
+            float minimum = heights[size_t(z) * gridCells * rowStride + size_t(x) * gridCells], maximum = minimum;
+            for (uint32_t texelZ = z * gridCells; texelZ <= (z + 1) * gridCells; texelZ++) {
+                float const* row = heights + texelZ * rowStride + size_t(x) * gridCells;
+                for (uint32_t texelX = 0; texelX <= gridCells; texelX++) {
+                    minimum = std::min(minimum, row[texelX]);
+                    maximum = std::max(maximum, row[texelX]);
+                }
+            }
+            low[size_t(z) * leaves + x] = minimum;
+            high[size_t(z) * leaves + x] = maximum;
+        }
+
+    bounds.resize(levels());
+    for (uint32_t lod = 0; lod < levels(); lod++) {
+        Level& level = bounds[lod];
+        level.side = leaves >> lod;
+        if (lod > 0) {
+            uint32_t childSide = level.side * 2;
+            std::vector<float> parentLow(size_t(level.side) * level.side), parentHigh(parentLow.size());
+            for (uint32_t z = 0; z < level.side; z++)
+                for (uint32_t x = 0; x < level.side; x++) {
+                    size_t child = size_t(2 * z) * childSide + 2 * x;
+                    parentLow[size_t(z) * level.side + x] =
+                        std::min({low[child], low[child + 1], low[child + childSide], low[child + childSide + 1]});
+                    parentHigh[size_t(z) * level.side + x] = std::max(
+                        {high[child], high[child + 1], high[child + childSide], high[child + childSide + 1]});
+                }
+            low = std::move(parentLow);
+            high = std::move(parentHigh);
+        }
+
+        size_t count = size_t(level.side) * level.side;
+        for (auto array : {&level.centerX, &level.centerY, &level.centerZ, &level.extentX, &level.extentY,
+                           &level.extentZ})
+            array->resize(count);
+        level.visible.resize(count);
+        glm::vec2 nodeExtent = glm::vec2(extent.x, extent.z) / float(level.side);
+        for (uint32_t z = 0; z < level.side; z++)
+            for (uint32_t x = 0; x < level.side; x++) {
+                size_t i = size_t(z) * level.side + x;
+                level.centerX[i] = origin.x + (float(x) + .5f) * nodeExtent.x;
+                level.centerZ[i] = origin.z + (float(z) + .5f) * nodeExtent.y;
+                level.centerY[i] = origin.y + (low[i] + high[i]) / 2 * extent.y;
+                level.extentX[i] = nodeExtent.x / 2;
+                level.extentZ[i] = nodeExtent.y / 2;
+                level.extentY[i] = (high[i] - low[i]) / 2 * extent.y;
+            }
+    }
+}
+
+void TerrainQuadtree::cull(std::array<glm::vec4, 6> const& frustum)
+{
+    for (Level& level : bounds) {
+        std::fill(level.visible.begin(), level.visible.end(), uint8_t(1));
+        for (glm::vec4 const& plane : frustum)
+            cullPlane(plane, level.visible.size(), level.centerX.data(), level.centerY.data(), level.centerZ.data(),
+                      level.extentX.data(), level.extentY.data(), level.extentZ.data(), level.visible.data());
+    }
+}
+
+std::vector<TerrainNode> const& TerrainQuadtree::select(glm::vec3 const& eye, std::array<glm::vec4, 6> const& frustum)
+{
+    cull(frustum);
+    for (auto& part : parts) part.clear();
+    // The root is in range of the top level everywhere, only the frustum can reject it
+    selectNode(0, 0, levels() - 1, eye);
+
+    selection.clear();
+    for (uint32_t part = 0; part < partCount; part++) {
+        batches[part] = {uint32_t(selection.size()), uint32_t(parts[part].size())};
+        selection.insert(selection.end(), parts[part].begin(), parts[part].end());
+    }
+    return selection;
+}
+
+bool TerrainQuadtree::selectNode(uint32_t x, uint32_t z, uint32_t lod, glm::vec3 const& eye)
+{
+    // Nothing of a culled node has to be drawn, not even by its parent
+    if (!bounds[lod].visible[size_t(z) * bounds[lod].side + x]) return true;
+    if (!inRange(x, z, lod, eye, ranges[lod])) return false;
+    if (lod == 0 || !inRange(x, z, lod, eye, ranges[lod - 1])) {
+        add(x, z, lod, whole);
+        return true;
+    }
+    // Children out of the range of their level are covered by this node
+    for (uint32_t q = 0; q < 4; q++)
+        if (!selectNode(2 * x + q % 2, 2 * z + q / 2, lod - 1, eye)) add(x, z, lod, Part(quadrant00 + q));
+    return true;
+}
+
+bool TerrainQuadtree::inRange(uint32_t x, uint32_t z, uint32_t lod, glm::vec3 const& eye, float range) const
+{
+    // The vertices lie in the box, so the distance never overestimates the one of a vertex
+    Level const& level = bounds[lod];
+    size_t i = size_t(z) * level.side + x;
+    glm::vec3 center(level.centerX[i], level.centerY[i], level.centerZ[i]);
+    glm::vec3 halfSize(level.extentX[i], level.extentY[i], level.extentZ[i]);
+    glm::vec3 offset = glm::clamp(eye, center - halfSize, center + halfSize) - eye;
+    return glm::dot(offset, offset) <= range * range;
+}
+
+void TerrainQuadtree::add(uint32_t x, uint32_t z, uint32_t lod, Part part)
+{
+    float step = float(1u << lod);
+    float nodeSize = step * float(gridCells);
+    glm::vec2 morph{0};
+    if (lod + 1 < levels()) {
+        // Morphs over the outer 30% of the range, fully on the coarser grid at its end
+        float end = ranges[lod];
+        float start = glm::mix(lod > 0 ? ranges[lod - 1] : 0.f, end, 0.7f);
+        morph = glm::vec2(start, 1) / (end - start);
+    }
+    parts[part].push_back({glm::vec2(float(x), float(z)) * nodeSize, step, morph});
+}
+
+void TerrainQuadtree::writeGridIndices(uint16_t* indices) const
+{
+    uint32_t side = gridCells + 1;
+    uint32_t half = gridCells / 2;
+    for (uint32_t q = 0; q < 4; q++)
+        for (uint32_t z = q / 2 * half; z < (q / 2 + 1) * half; z++)
+            for (uint32_t x = q % 2 * half; x < (q % 2 + 1) * half; x++) {
+                uint16_t first = uint16_t(z * side + x);
+                *indices++ = first;
+                *indices++ = uint16_t(first + 1);
+                *indices++ = uint16_t(first + side);
+                *indices++ = uint16_t(first + side);
+                *indices++ = uint16_t(first + 1);
+                *indices++ = uint16_t(first + side + 1);
+            }
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "shaderData.hpp"
+
+/**
+ * @brief Chunked LOD (CDLOD) quadtree over a square heightmap
+ *
+ * Every node is drawn with the same grid of gridCells x gridCells cells, a node of level lod spans gridCells << lod
+ * texels. The nodes are implicit, a node is addressed by its level and its position in the grid of that level. Each
+ * frame select() walks the tree from the root and picks the coarsest level whose vertex spacing stays below the
+ * allowed screen space error at the distance of the node. Vertices in the outer part of the range of a level morph
+ * towards the grid of the next coarser level, see TerrainNode::morph, so neighbouring levels meet without cracks and
+ * without popping.
+ *
+ * Every node has a precomputed bounding box from a min/max pyramid of the heights. The boxes of a level are stored as
+ * arrays of centers and extents, select() tests them against the view frustum in vectorizable loops before the walk.
+ * Culled nodes are left out of the selection, so it stays a compact list of instances.
+ *
+ * The terrain covers origin to origin + extent in world space, texel (x, z) of height h sits at
+ * origin + extent * (x / cells, h, z / cells).
+ */
+class TerrainQuadtree {
+public:
+    // What of a node a draw covers, the grid indices of each quadrant are contiguous
+    enum Part : uint32_t { whole, quadrant00, quadrant10, quadrant01, quadrant11, partCount };
+
+    // Instances of one part, consecutive in the selection
+    struct Batch {
+        uint32_t firstInstance;
+        uint32_t instanceCount;
+    };
+
+    /**
+     * @brief Creates the tree of a heightmap with cells + 1 texels per side
+     *
+     * cells has to be gridCells times a power of two.
+     *
+     * @param heights Heights between zero and one, rowStride floats apart. Only read by the constructor
+     */
+    TerrainQuadtree(uint32_t cells, uint32_t gridCells, glm::vec3 const& origin, glm::vec3 const& extent,
+                    float const* heights, size_t rowStride);
+
+    /**
+     * @brief Derives the range of each level from the projection
+     *
+     * @param fovY Vertical field of view in radians
+     * @param viewportHeight Height of the viewport in pixels
+     * @param pixelError Largest allowed size of a grid cell on the screen in pixels
+     */
+    void setScreenError(float fovY, float viewportHeight, float pixelError);
+
+    /**
+     * @brief Selects the nodes to draw for a camera at eye
+     *
+     * @param frustum Planes with inward normals, see CameraController::getFrustumPlanes
+     * @return Instance data of the visible selected nodes, grouped by part, see batch(). Valid until the next call
+     */
+    std::vector<TerrainNode> const& select(glm::vec3 const& eye, std::array<glm::vec4, 6> const& frustum);
+    Batch batch(Part part) const { return batches[part]; }
+
+    // Upper bound of the size of a selection, every selected part covers at least the area of a leaf
+    uint32_t maxSelection() const { return (cells / gridCells) * (cells / gridCells); }
+    uint32_t levels() const { return uint32_t(ranges.size()); }
+    float range(uint32_t lod) const { return ranges[lod]; }
+
+    /**
+     * @brief Grid shared by all nodes, there is no vertex data
+     *
+     * Vertex i of the grid sits at grid coordinates (i % (gridCells + 1), i / (gridCells + 1)). The indices of
+     * quadrant q of part quadrant00 + q start at q * gridIndexCount() / 4.
+     */
+    uint32_t gridVertexCount() const { return (gridCells + 1) * (gridCells + 1); }
+    uint32_t gridIndexCount() const { return gridCells * gridCells * 6; }
+    void writeGridIndices(uint16_t* indices) const;
+
+private:
+    // Bounding boxes of the nodes of one level, row by row
+    struct Level {
+        uint32_t side;
+        std::vector<float> centerX, centerY, centerZ;
+        std::vector<float> extentX, extentY, extentZ;
+        std::vector<uint8_t> visible;
+    };
+
+    void buildBounds(float const* heights, size_t rowStride);
+    void cull(std::array<glm::vec4, 6> const& frustum);
+    bool selectNode(uint32_t x, uint32_t z, uint32_t lod, glm::vec3 const& eye);
+    bool inRange(uint32_t x, uint32_t z, uint32_t lod, glm::vec3 const& eye, float range) const;
+    void add(uint32_t x, uint32_t z, uint32_t lod, Part part);
+
+    uint32_t cells;
+    uint32_t gridCells;
+    glm::vec3 origin;
+    glm::vec3 extent;
+    std::vector<float> ranges;  // Distance up to which a level is drawn, the top level is drawn everywhere
+    std::vector<Level> bounds;  // One per level, leaves first
+    std::array<std::vector<TerrainNode>, partCount> parts;
+    std::array<Batch, partCount> batches{};
+    std::vector<TerrainNode> selection;
+};
@@ -0,0 +1,39 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+/**
+ * @brief Hands the latest value from one writer thread to one reader thread without locks
+ *
+ * Writer and reader each own a slot, the third one is exchanged between them. The writer never waits and the reader
+ * always sees a complete value, intermediate values are dropped if the reader is slower.
+ */
+template <typename T>
+class TripleBuffer {
+public:
+    TripleBuffer() = default;
+    explicit TripleBuffer(T const& initial) : slots{initial, initial, initial} {}
+
+    // Writer side
+    T& write() { return slots[back]; }
+    void publish() { back = shared.exchange(back | freshBit, std::memory_order_acq_rel) & indexMask; }
+
+    // Reader side, update() returns true if a new value was published since the last call
+    bool update()
+    {
+        if (!(shared.load(std::memory_order_relaxed) & freshBit)) return false;
+        front = shared.exchange(front, std::memory_order_acq_rel) & indexMask;
+        return true;
+    }
+    T const& read() const { return slots[front]; }
+
+private:
+    static constexpr uint8_t indexMask = 0x3;
+    static constexpr uint8_t freshBit = 0x4;
+
+    std::array<T, 3> slots{};
+    std::atomic<uint8_t> shared{1};
+    uint8_t back = 0;
+    uint8_t front = 2;
+};
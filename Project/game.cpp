@@ -4,44 +4,163 @@
 using namespace std;
 
 /*Heightmap Function Implementations*/
+Heightmap::Heightmap(int width, int height, int border)
+    : width(width), height(height), border(border), data(stride() * (size_t(height) + 2 * border))
+{}
+
 float& Heightmap::at(int x, int y)
 {
     // Wrap around for the coordinates
-    x = (x + width) % width;
-    y = (y + height) % height;
-    return data[x + y * width];
+    x = (x % width + width) % width;
+    y = (y % height + height) % height;
+    return (*this)(x, y);
+}
+
+void Heightmap::fillBorder(Edge edge)
+{
+    auto source = [edge](int i, int size) {
+        return edge == Edge::wrap ? (i % size + size) % size : std::clamp(i, 0, size - 1);
+    };
+    // Left and right first, then the top and bottom rows are copied including their corners
+    for (int y = 0; y < height; y++) {
+        float* r = row(y);
+        for (int x = 1; x <= border; x++) {
+            r[-x] = r[source(-x, width)];
+            r[width - 1 + x] = r[source(width - 1 + x, width)];
+        }
+    }
+    for (int y = 1; y <= border; y++) {
+        std::copy_n(row(source(-y, height)) - border, stride(), row(-y) - border);
+        std::copy_n(row(source(height - 1 + y, height)) - border, stride(), row(height - 1 + y) - border);
+    }
 }
 
 void Heightmap::normalize()
 {
     float minF = 4e20;  // Pretty high
     float maxF = -6e9;  // Immature Joke
-    for (auto f : data) {
-        minF = glm::min(minF, f);
-        maxF = glm::max(maxF, f);
+    for (int y = 0; y < height; y++) {
+        float const* r = row(y);
+        for (int x = 0; x < width; x++) {
+            minF = glm::min(minF, r[x]);
+            maxF = glm::max(maxF, r[x]);
+        }
+    }
+    for (int y = 0; y < height; y++) {
+        float* r = row(y);
+        for (int x = 0; x < width; x++) r[x] = glm::remap(r[x], minF, maxF, 0.f, 1.f);
     }
-    for (auto& f : data) f = glm::remap(f, minF, maxF, 0.f, 1.f);
+}
+
+std::vector<float> Heightmap::packed() const
+{
+    std::vector<float> result(size_t(width) * height);
+    for (int y = 0; y < height; y++) std::copy_n(row(y), width, result.begin() + size_t(y) * width);
+    return result;
 }
 
 /*RNG Function Implementations*/
-RNG::RNG() : seed(rd()), generator(seed) {}
+namespace
+{
+    // Philox4x32-10, Salmon et al. "Parallel Random Numbers: As Easy as 1, 2, 3". Plain integer arithmetic without
+    // branches, so loops over it vectorize
+    inline void philox(uint32_t counter[4], uint32_t k0, uint32_t k1)
+    {
+        for (int round = 0; round < 10; round++) {
+            uint64_t product0 = uint64_t(0xD2511F53u) * counter[0];
+            uint64_t product1 = uint64_t(0xCD9E8D57u) * counter[2];
+            uint32_t c1 = counter[1], c3 = counter[3];
+            counter[0] = uint32_t(product1 >> 32) ^ c1 ^ k0;
+            counter[1] = uint32_t(product1);
+            counter[2] = uint32_t(product0 >> 32) ^ c3 ^ k1;
+            counter[3] = uint32_t(product0);
+            k0 += 0x9E3779B9u;
+            k1 += 0xBB67AE85u;
+        }
+    }
 
-RNG::RNG(uint32_t seed) : seed(seed), generator(seed) {}
+    inline float asFloat(uint32_t bits)
+    {
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    inline uint32_t asBits(float value)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+
+    // Natural logarithm for x in (0, 1], exponent plus atanh series of the mantissa, error below 2e-5
+    inline float fastLog(float x)
+    {
+        uint32_t bits = asBits(x);
+        float exponent = float(int32_t(bits >> 23) - 127);
+        float mantissa = asFloat((bits & 0x7fffffu) | 0x3f800000u);  // [1, 2)
+        float t = (mantissa - 1) / (mantissa + 1);
+        float t2 = t * t;
+        float series = t * (2 + t2 * (2.f / 3 + t2 * (2.f / 5 + t2 * (2.f / 7))));
+        return exponent * glm::ln_two<float>() + series;
+    }
+
+    // Sine for x in [-pi/2, pi/2], Taylor series up to x^9, error below 4e-6
+    inline float fastSin(float x)
+    {
+        float x2 = x * x;
+        return x * (1 + x2 * (-1.f / 6 + x2 * (1.f / 120 + x2 * (-1.f / 5040 + x2 * (1.f / 362880)))));
+    }
+
+    // Box-Muller with a sigma of .5. r * cos(2 pi w) and r * sin(pi (w - .5)) are distributed alike, the second one
+    // only needs the short sine range
+    inline float normalSample(uint32_t seed, uint32_t x, uint32_t y, uint32_t level)
+    {
+        uint32_t counter[4] = {x, y, level, 0};
+        philox(counter, seed, 0);
+        float u = float((counter[0] >> 8) + 1) * 0x1p-24f;  // (0, 1], the logarithm must not see 0
+        float w = float(counter[1] >> 8) * 0x1p-24f;        // [0, 1)
+        return .5f * std::sqrt(-2 * fastLog(u)) * fastSin(glm::pi<float>() * (w - .5f));
+    }
+}  // namespace
+
+RNG::RNG() : RNG(std::random_device{}()) {}
+
+RNG::RNG(uint32_t seed) : seed(seed) {}
 
 uint32_t RNG::getSeed() { return seed; }
 
-void RNG::reSeed(uint32_t seed) { generator.seed(seed); }
+void RNG::reSeed(uint32_t seed)
+{
+    this->seed = seed;
+    counter = 0;
+}
 
 float RNG::getFloat()
 {
-    // With a Sigma of .5, the values range roughly from -1.5 to 1.5
-    auto dist = std::normal_distribution<float>{0, .5};
-    float val = dist(generator);
-    return val;
+    // The running sequence is the stream of level -1, it never collides with grid points of real levels
+    uint64_t index = counter++;
+    return normalSample(seed, uint32_t(index), uint32_t(index >> 32), ~0u);
+}
+
+float RNG::getFloat(int x, int y, int level) const
+{
+    return normalSample(seed, uint32_t(x), uint32_t(y), uint32_t(level));
+}
+
+void RNG::fillNormal(float* values, size_t count, int firstX, int y, int level, int stepX) const
+{
+    for (size_t i = 0; i < count; i++)
+        values[i] = normalSample(seed, uint32_t(firstX + int(i) * stepX), uint32_t(y), uint32_t(level));
 }
 
 /*Diamond Square Function Implementations*/
-DiamondSquare::DiamondSquare(int n, bool wrap, int featureSizeRatio, uint32_t seed)
+namespace
+{
+    bool isPowerOfTwo(int value) { return value > 0 && !(value & (value - 1)); }
+}  // namespace
+
+DiamondSquare::DiamondSquare(int n, bool wrap, int featureSizeRatio, uint32_t seed, JobSystem* jobs) : jobs(jobs)
 {
     if (seed)
         rng.reSeed(seed);
@@ -57,181 +176,167 @@ DiamondSquare::DiamondSquare(int n, bool wrap, int featureSizeRatio, uint32_t se
 
 Heightmap& DiamondSquare::getHeightmap() { return heightmap; }
 
-// Regular diamond step with no wrapping
-void DiamondSquare::diamondStep(int x, int y, int step, double scale)
+void DiamondSquare::fillNoise(float* noise, int count, int firstX, int y, int step, float scale) const
 {
-    // Could I just pass halfstep instead of step as parameter?
-    int hs = step / 2;
-    // Yes, but hs is shorter to write
-    // and nobody would now what "hs" means as a paramter
-
-    int total = 0;
-    float value = 0;
-
-    bool left = x - hs >= 0;
-    bool right = x + hs < heightmap.width;
-    bool up = y - hs >= 0;
-    bool down = y + hs < heightmap.height;
-
-    if (up && left) {
-        total++;
-        value += heightmap.at(x - hs, y - hs);
-    }
-    if (up && right) {
-        total++;
-        value += heightmap.at(x + hs, y - hs);
-    }
-    if (down && left) {
-        total++;
-        value += heightmap.at(x - hs, y + hs);
-    }
-    if (down && right) {
-        total++;
-        value += heightmap.at(x + hs, y + hs);
-    }
-
-    heightmap.at(x, y) = value / total + rng.getFloat() * scale;
+    // The level of a point is its step, every point of the map is generated exactly once
+    rng.fillNormal(noise, size_t(count), firstX, y, step, step);
+    for (int i = 0; i < count; i++) noise[i] *= scale;
 }
 
-// Regular square step with no wrapping
-void DiamondSquare::squareStep(int x, int y, int step, double scale)
+void DiamondSquare::forEachBand(int rowCount, int pointsPerRow, std::function<void(int, int)> const& band)
 {
-    int hs = step / 2;
-
-    int total = 0;
-    float value = 0;
-    if (x - hs >= 0) {
-        value += heightmap.at(x - hs, y);
-        total++;
-    }
-    if (x + hs < heightmap.width) {
-        value += heightmap.at(x + hs, y);
-        total++;
-    }
-    if (y - hs >= 0) {
-        value += heightmap.at(x, y - hs);
-        total++;
-    }
-    if (y + hs < heightmap.height) {
-        value += heightmap.at(x, y + hs);
-        total++;
-    }
-    heightmap.at(x, y) = value / total + rng.getFloat() * scale;
+    // A band should be worth a few thousand points, smaller ones cost more to schedule than to compute
+    size_t grain = size_t(std::max(1, 4096 / std::max(pointsPerRow, 1)));
+    if (jobs)
+        jobs->parallelFor(0, size_t(rowCount), grain, [&](size_t first, size_t last) { band(int(first), int(last)); });
+    else
+        band(0, rowCount);
 }
 
-
 // Regular diamond square algorithm with no wrapping
 void DiamondSquare::generate(int n)
 {
-
     int res = (1 << n) + 1;
-    heightmap = {res, res, std::vector<float>(res * res)};
+    heightmap = Heightmap(res, res);
 
     // Init corners
-    heightmap.at(0, 0) = rng.getFloat();
-    heightmap.at(0, res - 1) = rng.getFloat();
-    heightmap.at(res - 1, 0) = rng.getFloat();
-    heightmap.at(res - 1, res - 1) = rng.getFloat();
+    for (int y : {0, res - 1})
+        for (int x : {0, res - 1}) heightmap(x, y) = rng.getFloat(x, y, 0);
 
-    double scale = 1;
+    // Within a level every diamond point only reads the previous levels and every square point only reads the
+    // diamond points and the previous levels, so each pass splits into row bands. Border points are peeled off the
+    // loops, the interior loops have no branches
+    float scale = 1;
     for (int step = res - 1; step > 1; step /= 2, scale /= 2) {
-        int halfstep = step / 2;
-
-        for (int y = halfstep; y < res; y += step) {
-            for (int x = halfstep; x < res; x += step) diamondStep(x, y, step, scale);
-        }
-
-        // Two for loops since the diamond centers are offset every second row
-        for (int y = 0; y < res; y += step) {
-            for (int x = halfstep; x < res; x += step) squareStep(x, y, step, scale);
-        }
-        for (int y = halfstep; y < res; y += step) {
-            for (int x = 0; x < res; x += step) squareStep(x, y, step, scale);
-        }
+        int hs = step / 2;
+        int cells = (res - 1) / step;
+
+        // Cell centers, all four corners of a cell exist without wrapping
+        forEachBand(cells, cells, [&](int first, int last) {
+            std::vector<float> noise(cells);
+            for (int cy = first; cy < last; cy++) {
+                int y = hs + cy * step;
+                fillNoise(noise.data(), cells, hs, y, step, scale);
+                float const* up = heightmap.row(y - hs);
+                float const* down = heightmap.row(y + hs);
+                float* center = heightmap.row(y);
+                for (int i = 0; i < cells; i++) {
+                    int x = hs + i * step;
+                    center[x] = (up[x - hs] + up[x + hs] + down[x - hs] + down[x + hs]) / 4 + noise[i];
+                }
+            }
+        });
+
+        // Edge midpoints, even rows lie between two corners, odd rows between two cell centers
+        forEachBand(2 * cells + 1, cells + 1, [&](int first, int last) {
+            std::vector<float> noise(cells + 1);
+            for (int r = first; r < last; r++) {
+                int y = r * hs;
+                float* row = heightmap.row(y);
+                // The first and the last row lack the neighbour outside of the map
+                float const* up = y > 0 ? heightmap.row(y - hs) : nullptr;
+                float const* down = y < res - 1 ? heightmap.row(y + hs) : nullptr;
+                if (r % 2 == 0) {
+                    fillNoise(noise.data(), cells, hs, y, step, scale);
+                    if (!up) {
+                        for (int i = 0, x = hs; i < cells; i++, x += step)
+                            row[x] = (row[x - hs] + row[x + hs] + down[x]) / 3 + noise[i];
+                    } else if (!down) {
+                        for (int i = 0, x = hs; i < cells; i++, x += step)
+                            row[x] = (row[x - hs] + row[x + hs] + up[x]) / 3 + noise[i];
+                    } else {
+                        for (int i = 0, x = hs; i < cells; i++, x += step)
+                            row[x] = (row[x - hs] + row[x + hs] + up[x] + down[x]) / 4 + noise[i];
+                    }
+                } else {
+                    fillNoise(noise.data(), cells + 1, 0, y, step, scale);
+                    row[0] = (row[hs] + up[0] + down[0]) / 3 + noise[0];
+                    for (int i = 1, x = step; i < cells; i++, x += step)
+                        row[x] = (row[x - hs] + row[x + hs] + up[x] + down[x]) / 4 + noise[i];
+                    int x = res - 1;
+                    row[x] = (row[x - hs] + up[x] + down[x]) / 3 + noise[cells];
+                }
+            }
+        });
     }
 }
 
-// Diamond step with wrapping
-// Would this qualify for the bonus task "Other Algorithm"?  Maybe, but probably not
-void DiamondSquare::diamondStepWrapped(int x, int y, int step, double scale)
-{
-    int hs = step / 2;
-    heightmap.at(x, y) = (heightmap.at(x - hs, y - hs) + heightmap.at(x + hs, y - hs) + heightmap.at(x - hs, y + hs) +
-                          heightmap.at(x + hs, y + hs)) /
-                         4 +
-                         rng.getFloat() * scale;
-}
-
-// Square step with wrapping
-void DiamondSquare::squareStepWrapped(int x, int y, int step, double scale)
-{
-    int hs = step / 2;
-    heightmap.at(x, y) = (heightmap.at(x - hs, y + 0) + heightmap.at(x + hs, y + 0) + heightmap.at(x + 0, y - hs) +
-                          heightmap.at(x + 0, y + hs)) /
-                         4 +
-                         rng.getFloat() * scale;
-}
-
 // Diamond Square Algorithm using wrapping behavior of heightmap access
+// Would this qualify for the bonus task "Other Algorithm"?  Maybe, but probably not
 void DiamondSquare::generateWrapped(int n, int featureSizeRatio)
 {
     int res = (1 << n);
-    heightmap = {res, res, std::vector<float>(res * res)};
+    heightmap = Heightmap(res, res);
 
     // Wrapping behavior allows for variance in the feature size of the algorithm
     // Default feature size of 2 makes more interesting heightmaps (personal opinion)
+    if (!isPowerOfTwo(featureSizeRatio) || featureSizeRatio > res)
+        throw std::runtime_error("[Resource Generator] The feature size ratio has to be a power of two up to 2^n");
     int featureSize = res / featureSizeRatio;
-    heightmap.at(0, 0) = rng.getFloat();
-    heightmap.at(featureSize, 0) = rng.getFloat();
-    heightmap.at(0, featureSize) = rng.getFloat();
-    heightmap.at(featureSize, featureSize) = rng.getFloat();
-
-    double scale = 1;
+    heightmap.at(0, 0) = rng.getFloat(0, 0, 0);
+    heightmap.at(featureSize, 0) = rng.getFloat(featureSize, 0, 0);
+    heightmap.at(0, featureSize) = rng.getFloat(0, featureSize, 0);
+    heightmap.at(featureSize, featureSize) = rng.getFloat(featureSize, featureSize, 0);
+
+    // Same passes as generate(), only the rows and columns at the edges wrap around
+    auto rowAt = [&](int y) { return heightmap.row((y + res) % res); };
+    float scale = 1;
     for (int step = featureSize; step > 1; step /= 2, scale /= 2) {
-        int halfstep = step / 2;
-
-        for (int y = halfstep; y < heightmap.height + halfstep; y += step)
-            for (int x = halfstep; x < heightmap.width + halfstep; x += step) diamondStepWrapped(x, y, step, scale);
-
-        for (int y = 0; y < res; y += step)
-            for (int x = halfstep; x < res; x += step) squareStepWrapped(x, y, step, scale);
-
-        for (int y = halfstep; y < res; y += step)
-            for (int x = 0; x < res; x += step) squareStepWrapped(x, y, step, scale);
+        int hs = step / 2;
+        int cells = res / step;
+
+        forEachBand(cells, cells, [&](int first, int last) {
+            std::vector<float> noise(cells);
+            for (int cy = first; cy < last; cy++) {
+                int y = hs + cy * step;
+                fillNoise(noise.data(), cells, hs, y, step, scale);
+                float const* up = rowAt(y - hs);
+                float const* down = rowAt(y + hs);
+                float* center = rowAt(y);
+                for (int i = 0, x = hs; i < cells - 1; i++, x += step)
+                    center[x] = (up[x - hs] + up[x + hs] + down[x - hs] + down[x + hs]) / 4 + noise[i];
+                int x = res - hs;
+                center[x] = (up[x - hs] + up[0] + down[x - hs] + down[0]) / 4 + noise[cells - 1];
+            }
+        });
+
+        forEachBand(2 * cells, cells, [&](int first, int last) {
+            std::vector<float> noise(cells);
+            for (int r = first; r < last; r++) {
+                int y = r * hs;
+                float* row = rowAt(y);
+                float const* up = rowAt(y - hs);
+                float const* down = rowAt(y + hs);
+                if (r % 2 == 0) {
+                    fillNoise(noise.data(), cells, hs, y, step, scale);
+                    for (int i = 0, x = hs; i < cells - 1; i++, x += step)
+                        row[x] = (row[x - hs] + row[x + hs] + up[x] + down[x]) / 4 + noise[i];
+                    int x = res - hs;
+                    row[x] = (row[x - hs] + row[0] + up[x] + down[x]) / 4 + noise[cells - 1];
+                } else {
+                    fillNoise(noise.data(), cells, 0, y, step, scale);
+                    row[0] = (row[res - hs] + row[hs] + up[0] + down[0]) / 4 + noise[0];
+                    for (int i = 1, x = step; i < cells; i++, x += step)
+                        row[x] = (row[x - hs] + row[x + hs] + up[x] + down[x]) / 4 + noise[i];
+                }
+            }
+        });
     }
 }
 
-HDRImage createMipMap(HDRImage image, int mipLevel)
+HDRImage createMipMap(HDRImage const& image, int mipLevel)
 {
-    HDRImage result = image;
-    for (int currentLevel = 0; currentLevel < mipLevel; currentLevel++) {
-        if (result.width == result.height == 1) {
-            return result;
-        }
-        result = generateMipMap(result);
-    }
-    return result;
+    auto chain = tga::buildMipChain(image, tga::MipFilter::box, uint32_t(mipLevel) + 1);
+    // Chains end at 1x1, deeper levels return the last one
+    uint32_t level = chain.levelCount() - 1;
+    size_t levelSize = size_t(chain.levelWidth(level)) * chain.levelHeight(level) * chain.components;
+    return {chain.levelWidth(level), chain.levelHeight(level), chain.components,
+            vector<float>(chain.level(level), chain.level(level) + levelSize)};
 }
 
-HDRImage generateMipMap(HDRImage image)
-{
-    vector<float> data = image.data;
-    vector<float> newData;
-    for (int y = 0; y < image.height - 1; y++) {
-        for (int x = 0; x < image.width - 1; x++) {
-            float value;
-            value = data[x + y * image.width] + data[x + 1 + y * image.width] + data[x + (y + 1) * image.width] +
-                    data[x + 1 + (y + 1) * image.width] / 4.0f;
-            newData.push_back(value);
-            x++;
-        }
-        y++;
-    }
-    HDRImage result = {image.width / 2, image.height / 2, image.components, newData};
-    return result;
-}
+HDRImage generateMipMap(HDRImage const& image) { return createMipMap(image, 1); }
 
-vector<float> createHeightmap(int size)
+Heightmap createHeightmap(int size, JobSystem* jobs)
 {
     // int size = 1025;
     int maxLen = std::max(size, size);
@@ -243,57 +348,108 @@ vector<float> createHeightmap(int size)
     int powerTwo = 1 << n;  // A shift to the left is equivalent to multiplying by 2 and we shift n time
     if (powerTwo < std::max(size, size)) n++;
 
-    DiamondSquare ds{n, false, false, false};
+    DiamondSquare ds{n, false, false, false, jobs};
     auto& tempHeightmap = ds.getHeightmap();
 
-    // Trim the heightmap to the desired dimensions
-    Heightmap heightmap{size, size, std::vector<float>(size * size)};
-    for (int y = 0; y < size; y++)
-        for (int x = 0; x < size; x++) heightmap.at(x, y) = tempHeightmap.at(x, y);
+    // Trim the heightmap to the desired dimensions, the apron lets neighbour lookups skip the edge checks
+    Heightmap heightmap(size, size, 1);
+    for (int y = 0; y < size; y++) std::copy_n(tempHeightmap.row(y), size, heightmap.row(y));
 
     // Remap to a valid range, we can't have less than 0 in hdr
     heightmap.normalize();
-    return heightmap.data;
+    heightmap.fillBorder(Heightmap::Edge::clamp);
+    return heightmap;
 }
 
-vector<vec3> generateNormalMap(vector<float> source, int length)
+namespace
 {
-    vector<float> data = source;
-    vector<vec3> result;
-    for (int y = 0; y < length; y++) {
-        for (int x = 0; x < length; x++) {
-            float fx0, fx1;
-            if (x > 0)
-                fx0 = data[x - 1 + y * length];
-            else
-                fx0 = data[x + y * length];
-
-            if (x < length - 1)
-                fx1 = data[x + 1 + y * length];
-            else
-                fx1 = data[x + y * length];
-
-            float fy0, fy1;
-            if (y > 0)
-                fy0 = data[x + (y - 1) * length];
-            else
-                fy0 = data[x + y * length];
+    /**
+     * Unit normals of row y into nx, ny and nz. The apron replaces the edge cases, so the loop has no branches and
+     * the compiler vectorizes it
+     */
+    void normalRow(Heightmap const& heightmap, int y, float* __restrict nx, float* __restrict ny, float* __restrict nz)
+    {
+        float const* row = heightmap.row(y);
+        float const* up = heightmap.row(y - 1);
+        float const* down = heightmap.row(y + 1);
+        // Texels are 2 / (side - 1) apart, the central differences span two of them
+        float scaleX = float(heightmap.width - 1) / 4;
+        float scaleY = float(heightmap.height - 1) / 4;
+        for (int x = 0; x < heightmap.width; x++) {
+            float dx = (row[x + 1] - row[x - 1]) * scaleX;
+            float dy = (down[x] - up[x]) * scaleY;
+            float inverseLength = 1 / std::sqrt(dx * dx + dy * dy + 1);
+            nx[x] = -dx * inverseLength;
+            ny[x] = -dy * inverseLength;
+            nz[x] = inverseLength;
+        }
+    }
 
-            if (y < length - 1)
-                fy1 = data[x + (y + 1) * length];
-            else
-                fy1 = data[x + y * length];
+    // Calls band(first, last, nx, ny, nz) for bands of rows, every band has its own row of scratch
+    template <typename Band>
+    void forEachNormalBand(Heightmap const& heightmap, JobSystem* jobs, Band const& band)
+    {
+        if (heightmap.border < 1)
+            throw std::runtime_error("[Resource Generator] Normal maps need a heightmap with an apron");
+        auto run = [&](size_t first, size_t last) {
+            std::vector<float> scratch(3 * size_t(heightmap.width));
+            float* nx = scratch.data();
+            float* ny = nx + heightmap.width;
+            float* nz = ny + heightmap.width;
+            for (size_t y = first; y < last; y++) {
+                normalRow(heightmap, int(y), nx, ny, nz);
+                band(int(y), nx, ny, nz);
+            }
+        };
+        // A band should be worth a few thousand texels, like the diamond square bands
+        size_t grain = size_t(std::max(1, 4096 / std::max(heightmap.width, 1)));
+        if (jobs)
+            jobs->parallelFor(0, size_t(heightmap.height), grain, run);
+        else
+            run(0, size_t(heightmap.height));
+    }
 
-            float scaleX = remap((float)x, 1.0f, (float)length, 0.0f, 1.0f);
-            float scaleY = remap((float)y, 1.0f, (float)length, 0.0f, 1.0f);
+    inline int8_t toSnorm8(float value) { return int8_t(value * 127 + (value < 0 ? -.5f : .5f)); }
+}  // namespace
 
-            float dx = (fx1 - fx0) / (2 * scaleX), dy = (fy1 - fy0) / (2 * scaleY);
+void generateNormalMap(Heightmap const& heightmap, vec3* normals, JobSystem* jobs)
+{
+    forEachNormalBand(heightmap, jobs, [&](int y, float const* nx, float const* ny, float const* nz) {
+        vec3* out = normals + size_t(y) * heightmap.width;
+        for (int x = 0; x < heightmap.width; x++) out[x] = vec3(nx[x], ny[x], nz[x]);
+    });
+}
 
-            vec3 n = vec3(-1 * dx, -1 * dy, (scaleX + scaleY) / length);
-            n = normalize(n);
-            result.push_back(n);
+void generateNormalMap(Heightmap const& heightmap, NormalEncoding encoding, int8_t* texels, JobSystem* jobs)
+{
+    forEachNormalBand(heightmap, jobs, [&](int y, float const* nx, float const* ny, float const* nz) {
+        // Byte stores may alias the heightmap, a local width keeps the loops countable for the vectorizer
+        int width = heightmap.width;
+        int8_t* out = texels + 2 * size_t(y) * width;
+        if (encoding == NormalEncoding::hemisphere) {
+            for (int x = 0; x < width; x++) {
+                out[2 * x] = toSnorm8(nx[x]);
+                out[2 * x + 1] = toSnorm8(ny[x]);
+            }
+            return;
         }
-    }
+        // Projection onto the octahedron |x| + |y| + |z| = 1, the lower half folds over the diagonals. Height field
+        // normals never reach the lower half, the fold keeps the encoding general
+        for (int x = 0; x < width; x++) {
+            float inverseNorm = 1 / (std::abs(nx[x]) + std::abs(ny[x]) + std::abs(nz[x]));
+            float u = nx[x] * inverseNorm, v = ny[x] * inverseNorm;
+            float foldedU = (1 - std::abs(v)) * (u < 0 ? -1.f : 1.f);
+            float foldedV = (1 - std::abs(u)) * (v < 0 ? -1.f : 1.f);
+            out[2 * x] = toSnorm8(nz[x] < 0 ? foldedU : u);
+            out[2 * x + 1] = toSnorm8(nz[x] < 0 ? foldedV : v);
+        }
+    });
+}
+
+vector<vec3> generateNormalMap(Heightmap const& heightmap, JobSystem* jobs)
+{
+    vector<vec3> result(size_t(heightmap.width) * heightmap.height);
+    generateNormalMap(heightmap, result.data(), jobs);
     return result;
 }
 
@@ -321,53 +477,7 @@ vector<uint8_t> convertNormalMap(vector<vec3> source)
 }
 
 class Game : public Framework {
-    vector<Vertex> createVertexBuffer(vector<float> heightmap, vector<vec3> normalmap)
-    {
-        this->heightmap = heightmap;
-        this->normalmap = normalmap;
-        vector<Vertex> vertices;
-        vertices.resize(heightmap.size());
-
-        for (float z = 0; z < sqrt(heightmap.size()); z++) {
-            for (float x = 0; x < sqrt(heightmap.size()); x++) {
-                vertices[z * sqrt(heightmap.size()) + x].position = {(2.0f * x) / (sqrt(heightmap.size()) - 1) - 1.0f,
-                                                                     heightmap[z * sqrt(heightmap.size()) + x],
-                                                                     (2.0f * z) / (sqrt(heightmap.size()) - 1) - 1.0};
-                vertices[z * sqrt(heightmap.size()) + x].texcoord = {
-                    static_cast<float>(x) / (sqrt(heightmap.size()) - 1),
-                    static_cast<float>(z) / (sqrt(heightmap.size()) - 1)};
-            }
-        }
-
-        for (int i = 0; i < normalmap.size(); i++) {
-            vertices[i].normal.x = normalmap[i].x;
-            vertices[i].normal.y = normalmap[i].y;
-            vertices[i].normal.z = normalmap[i].z;
-        }
-
-        this->vertices = vertices;
-        return vertices;
-    }
-
-    vector<int> createIndexBuffer(vector<Vertex> vertices)
-    {
-        vector<int> index;
-        for (float z = 0; z < sqrt(heightmap.size())-1; z++) {
-            for (float x = 0; x < sqrt(heightmap.size()) - 1; x++) {
-                index.push_back(x + (z * sqrt(vertices.size())));
-                index.push_back((x + (z * sqrt(vertices.size())) + 1));
-                index.push_back(x + ((z + 1) * sqrt(vertices.size())));
-                index.push_back(x + ((z + 1) * sqrt(vertices.size())));
-                index.push_back(x + 1 + (z * sqrt(vertices.size())));
-                index.push_back(x + 1 + ((z + 1) * sqrt(vertices.size())));
-            }
-        }
-
-        this->index = index;
-        return index;
-    }
-
-    TerrainData createTerrainUniformBuffer(vector<float> heightmap)
+    TerrainData createTerrainUniformBuffer(Heightmap const& heightmap)
     {
         TerrainData uniformTerrain;
         uniformTerrain.dimensions = vec3(10.0f, 10.0f, 10.0f);
@@ -381,43 +491,39 @@ class Game : public Framework {
         return tga::loadTexture(pathToTexture, tga::Format::r8g8b8a8_srgb, tga::SamplerMode::linear, tgai);
     }
 
-    void createBackgroundResources()
+    // All pipelines are compiled in one batch, so TGA can build them in parallel
+    void createRenderPasses()
     {
-        auto bgVS = tga::loadShader("shaders/background_vert.spv", tga::ShaderType::vertex, tgai);
-        auto bgFS = tga::loadShader("shaders/background_frag.spv", tga::ShaderType::fragment, tgai);
-        backgroundPass = tgai->createRenderPass(
-            {{bgVS, bgFS},
+        auto bgVS = assets.shader("shaders/background_vert.spv", tga::ShaderType::vertex);
+        auto bgFS = assets.shader("shaders/background_frag.spv", tga::ShaderType::fragment);
+        auto terrainVS = assets.shader("shaders/terrain_proxy_vert.spv", tga::ShaderType::vertex);
+        auto terrainFS = assets.shader("shaders/terrain_proxy_frag.spv", tga::ShaderType::fragment);
+        auto feedbackFS = assets.shader("shaders/terrain_feedback_frag.spv", tga::ShaderType::fragment);
+        auto enemyVS = assets.shader("shaders/instances_vert.spv", tga::ShaderType::vertex);
+        auto meshVS = assets.shader("shaders/phong_vert.spv", tga::ShaderType::vertex);
+        auto proxyVS = assets.shader("shaders/occlusion_proxy_vert.spv", tga::ShaderType::vertex);
+        auto proxyFS = assets.shader("shaders/occlusion_proxy_frag.spv", tga::ShaderType::fragment);
+        // Without bindless support the materials can't be picked per draw, see materialBindings
+        auto phongFS = assets.shader(
+            tgai->bindlessSupported() ? "shaders/phong_frag.spv" : "shaders/phong_fixed_frag.spv",
+            tga::ShaderType::fragment);
+
+        // The terrain has no vertex buffer, the vertex shader derives the grid position from the vertex index
+        auto terrainGrid = tga::SpecializationInfo(tga::ShaderType::vertex).set(0, int32_t(terrainGridCells));
+        VertexLayout enemyVertexLayout = tga::PackedVertex::layout(tga::PositionEncoding::unorm16);
+        // Barrel and base of a gun share one transform, so the positions are stored as half floats which need no
+        // per mesh dequantization
+        tga::VertexLayout meshVertexLayout = tga::PackedVertex::layout(tga::PositionEncoding::sfloat16);
+
+        auto passes = tgai->createRenderPasses({
+            {{*bgVS, *bgFS},
              frameworkWindow,
              tga::ClearOperation::none,
              {},
              {},
              {{/* Three uniform Buffers for the System Input*/
-                  {tga::BindingType::uniformBuffer, tga::BindingType::uniformBuffer, tga::BindingType::uniformBuffer}}}});
-        systemInputSet = makeSystemInputSet(backgroundPass);
-
-        // Shaders get backed into the renderpass, we don't need the modules anymore, so free them
-        tgai->free(bgVS);
-        tgai->free(bgFS);
-    }
-
-    void createTerrainResources()
-    {
-        auto terrainVS = tga::loadShader("shaders/terrain_proxy_vert.spv", tga::ShaderType::vertex, tgai);
-        auto terrainFS = tga::loadShader("shaders/terrain_proxy_frag.spv", tga::ShaderType::fragment, tgai);
-
-        /*TODO: adjust to your own Vertex Buffer Layout*/
-        tga::VertexLayout terrainVertexLayout{
-            /*Size of a single Vertex, vec4 position, vec3 normal, vec2 textureCoordinates*/
-            (sizeof(Vertex)),
-            {
-                /*{offset in bytes from start of a vector, Format of the component}*/
-                {offsetof(Vertex, position), tga::Format::r32g32b32_sfloat}, /* Position x,y,z */
-                {offsetof(Vertex, normal), tga::Format::r32g32b32_sfloat},   /* Normal x,y,z*/
-                {offsetof(Vertex, texcoord), tga::Format::r32g32_sfloat}     /* Texture Coordinates x,y*/
-            }};
-
-        terrainPass = tgai->createRenderPass(
-            {{terrainVS, terrainFS},
+                  {tga::BindingType::uniformBuffer, tga::BindingType::uniformBuffer, tga::BindingType::uniformBuffer}}}},
+            {{*terrainVS, *terrainFS},
              frameworkWindow,
              tga::ClearOperation::depth,
              {tga::FrontFace::clockwise,tga::CullMode::none},
@@ -426,42 +532,333 @@ class Game : public Framework {
                   {tga::BindingType::uniformBuffer, tga::BindingType::uniformBuffer, tga::BindingType::uniformBuffer},
 
                   /*Set 1: Terrain Data*/
-                  {tga::BindingType::uniformBuffer,
-                   tga::BindingType::sampler /*TODO: Declare more Bindings for your Shader here*/}
+                  terrainSetLayout()
 
               }},
-             terrainVertexLayout});
+             {},
+             {terrainGrid}},
+            {{*terrainVS, *feedbackFS},
+             terrainTexture->feedback,
+             tga::ClearOperation::all,
+             {tga::FrontFace::clockwise, tga::CullMode::none},
+             {tga::CompareOperation::less},
+             {{/*Set 0: Three uniform Buffers for the System Input*/
+                  {tga::BindingType::uniformBuffer, tga::BindingType::uniformBuffer, tga::BindingType::uniformBuffer},
 
-        terrainCenter = vec3(5.0f, 5.0f, 5.0f);
-        terrainRadius = 10.0f;
-        vector<float> heightHuiMap = createHeightmap(1025);
+                  /*Set 1: Terrain Data, same layout as the terrain pass*/
+                  terrainSetLayout()}},
+             {},
+             {terrainGrid, tga::SpecializationInfo(tga::ShaderType::fragment)
+                               .set(0, -std::log2(float(terrainTextureInfo.feedbackScale)))}},
+            {{*enemyVS, *phongFS},
+             frameworkWindow,
+             tga::ClearOperation::none,
+             {tga::FrontFace::counterclockwise, tga::CullMode::none},
+             {tga::CompareOperation::less},
+             {{
+                  /*Set 0: Three uniform Buffers for the System Input*/
+                  {tga::BindingType::uniformBuffer, tga::BindingType::uniformBuffer, tga::BindingType::uniformBuffer},
 
-        vector<vec3> normalHuiMap = generateNormalMap(heightHuiMap, 1025);
+                  /*Set 1: Material Textures, Camera Position, Instances*/
+                  materialSetLayout(),
+              }},
+             enemyVertexLayout,
+             {fogSpecialization()}},
+            {{*meshVS, *phongFS},
+             frameworkWindow,
+             tga::ClearOperation::depth,
+             {tga::FrontFace::counterclockwise,tga::CullMode::none},
+             {tga::CompareOperation::less},
+             {{/*Set 0: Three uniform Buffers for the System Input*/
+                  {tga::BindingType::uniformBuffer, tga::BindingType::uniformBuffer, tga::BindingType::uniformBuffer},
+
+                  /*Set 1: Material Textures, Camera Position, Draws*/
+                  materialSetLayout(),
+              }},
+             meshVertexLayout,
+             {tga::SpecializationInfo(tga::ShaderType::vertex).set(0, cockpitScale), fogSpecialization()}},
+            {{*proxyVS, *proxyFS},
+             frameworkWindow,
+             tga::ClearOperation::none,
+             {tga::FrontFace::counterclockwise, tga::CullMode::none},
+             /*Depth test only, the boxes must not hide anything*/
+             {tga::CompareOperation::less, false, tga::BlendFactor::srcAlpha, tga::BlendFactor::oneMinusSrcAlpha,
+              tga::BlendFactor::one, tga::BlendFactor::oneMinusSrcAlpha, false},
+             {{/*Set 0: Three uniform Buffers for the System Input*/
+                  {tga::BindingType::uniformBuffer, tga::BindingType::uniformBuffer, tga::BindingType::uniformBuffer},
 
-        vector<Vertex> vertices = createVertexBuffer(heightHuiMap, normalHuiMap);
+                  /*Set 1: Draws*/
+                  {tga::BindingType::storageBuffer}}}},
+        });
+        backgroundPass = passes[0];
+        terrainPass = passes[1];
+        feedbackPass = passes[2];
+        enemyPass = passes[3];
+        meshPass = passes[4];
+        occlusionProxyPass = passes[5];
+
+        // Shaders get backed into the renderpass, the cache frees the modules once the last reference goes away here
+    }
 
-        this->vertexBuffer = tgai->createBuffer(
-            tga::BufferInfo{tga::BufferUsage::vertex, tga::memoryAccess(vertices), vertices.size() * sizeof(Vertex)});
+    void createBackgroundResources()
+    {
+        systemInputSet = makeSystemInputSet(backgroundPass);
+    }
 
-        vector<int> indices = createIndexBuffer(this->vertices);
+    // Mirrors the Level block of terrain_generate.comp
+    struct TerrainLevel {
+        int32_t resolution;
+        int32_t step;
+        float scale;
+        uint32_t seed;
+        int32_t size;
+    };
+
+    /**
+     * @brief Generates the terrain with a chain of compute passes
+     *
+     * The passes run the levels of DiamondSquare::generate with the same Philox noise, then normalize the heights and
+     * derive the octahedral normals. Heights and normals are copied into their textures on the device. The heights
+     * come back once for the bounds of terrainLod and loadTerrainPage.
+     */
+    void generateTerrain(int size)
+    {
+        // Same map size as createHeightmap, the terrain is cut from its top left corner
+        int n = 0;
+        while ((1 << n) < size) n++;
+        int resolution = (1 << n) + 1;
+        RNG rng;
+        std::cout << "[Resource Generator] GPU Diamond Square using seed: " << rng.getSeed() << "\n";
+
+        size_t heightCount = size_t(resolution) * resolution;
+        tga::Buffer heights = tgai->createBuffer({tga::BufferUsage::storage, nullptr, heightCount * sizeof(float)});
+        for (int y : {0, resolution - 1})
+            for (int x : {0, resolution - 1}) {
+                float corner = rng.getFloat(x, y, 0);
+                tgai->updateBuffer(heights, tga::memoryAccess(corner), sizeof(float),
+                                   uint32_t((size_t(y) * resolution + x) * sizeof(float)));
+            }
+        uint32_t emptyRange[2] = {0xffffffff, 0};
+        tga::Buffer range = tgai->createBuffer({tga::BufferUsage::storage, tga::memoryAccess(emptyRange),
+                                                sizeof(emptyRange)});
+        // Two texels of two bytes share an element
+        uint32_t texelCount = uint32_t(size) * uint32_t(size);
+        uint32_t normalPairs = (texelCount + 1) / 2;
+        tga::Buffer normals = tgai->createBuffer({tga::BufferUsage::storage, nullptr, normalPairs * sizeof(uint32_t)});
+
+        heightTexture = tgai->createTexture({uint32_t(size), uint32_t(size), tga::Format::r32_sfloat, nullptr, 0,
+                                             tga::SamplerMode::linear, tga::AddressMode::clampEdge});
+        normalTexture = tgai->createTexture({uint32_t(size), uint32_t(size), tga::Format::r8g8_snorm, nullptr, 0,
+                                             tga::SamplerMode::linear, tga::AddressMode::clampEdge});
+
+        // One pipeline per stage of terrain_generate.comp, all of them share the layout
+        enum Stage : int32_t { diamondStage, squareStage, rangeStage, normalizeStage, normalStage, stageCount };
+        auto generateCS = assets.shader("shaders/terrain_generate_comp.spv", tga::ShaderType::compute);
+        tga::SetLayout setLayout{tga::BindingType::storageBuffer, tga::BindingType::uniformBuffer,
+                                 tga::BindingType::storageBuffer, tga::BindingType::storageBuffer};
+        std::vector<tga::RenderPassInfo> passInfos;
+        for (int32_t stage = 0; stage < stageCount; stage++)
+            passInfos.push_back({{*generateCS}, frameworkWindow, tga::ClearOperation::none, {}, {}, {{setLayout}},
+                                 {}, {tga::SpecializationInfo(tga::ShaderType::compute).set(0, stage)}});
+        auto passes = tgai->createRenderPasses(passInfos);
+
+        // Without push constants every level gets its own uniform buffer
+        std::vector<tga::Buffer> levelBuffers;
+        std::vector<tga::InputSet> inputSets;
+        auto makeInputSet = [&](Stage stage, TerrainLevel level) {
+            levelBuffers.push_back(
+                tgai->createBuffer({tga::BufferUsage::uniform, tga::memoryAccess(level), sizeof(TerrainLevel)}));
+            inputSets.push_back(tgai->createInputSet(
+                {passes[stage], 0, {{heights, 0}, {levelBuffers.back(), 1}, {range, 2}, {normals, 3}}}));
+            return inputSets.back();
+        };
+        auto groups = [](uint32_t threads) { return (threads + 7) / 8; };
+        auto run = [&](Stage stage, TerrainLevel level, uint32_t threadsX, uint32_t threadsY) {
+            tga::InputSet inputSet = makeInputSet(stage, level);
+            tgai->setRenderPass(passes[stage], 0);
+            tgai->bindInputSet(inputSet);
+            tgai->dispatch(groups(threadsX), groups(threadsY), 1);
+        };
+
+        tgai->beginCommandBuffer();
+        float scale = 1;
+        for (int step = resolution - 1; step > 1; step /= 2, scale /= 2) {
+            TerrainLevel level{resolution, step, scale, rng.getSeed(), size};
+            uint32_t levelCells = uint32_t((resolution - 1) / step);
+            run(diamondStage, level, levelCells, levelCells);
+            run(squareStage, level, levelCells + 1, 2 * levelCells + 1);
+        }
+        TerrainLevel terrain{resolution, 1, 0, rng.getSeed(), size};
+        run(rangeStage, terrain, uint32_t(size), uint32_t(size));
+        run(normalizeStage, terrain, uint32_t(size), uint32_t(size));
+        // The pairs are spread over rows of a whole number of groups
+        uint32_t pairsPerRow = groups(uint32_t(size)) * 8;
+        run(normalStage, terrain, pairsPerRow, (normalPairs + pairsPerRow - 1) / pairsPerRow);
+        tgai->copyBufferToTexture(heights, heightTexture, uint32_t(resolution));
+        tgai->copyBufferToTexture(normals, normalTexture);
+        tga::CommandBuffer generation = tgai->endCommandBuffer();
+        tgai->execute(generation);
+
+        // Readback waits for the passes
+        std::vector<uint8_t> heightData = tgai->readback(heights);
+        heightmap = Heightmap(size, size);
+        for (int y = 0; y < size; y++)
+            std::memcpy(heightmap.row(y), heightData.data() + size_t(y) * resolution * sizeof(float),
+                        size * sizeof(float));
+
+        tgai->free(generation);
+        for (auto inputSet : inputSets) tgai->free(inputSet);
+        for (auto pass : passes) tgai->free(pass);
+        for (auto buffer : levelBuffers) tgai->free(buffer);
+        for (auto buffer : {heights, range, normals}) tgai->free(buffer);
+    }
 
-        this->indexBuffer = tgai->createBuffer(
-            tga::BufferInfo{tga::BufferUsage::index, tga::memoryAccess(indices), indices.size() * sizeof(int)});
+    void createTerrainResources()
+    {
+        terrainCenter = vec3(5.0f, 5.0f, 5.0f);
+        terrainRadius = 10.0f;
+        if (gpuTerrain)
+            generateTerrain(1025);
+        else {
+            heightmap = createHeightmap(1025, &jobs);
+            uploadTerrainTextures();
+        }
 
-        TerrainData uniformTerrainData = createTerrainUniformBuffer(heightHuiMap);
+        TerrainData uniformTerrainData = createTerrainUniformBuffer(heightmap);
         this->uniformBuffer = tgai->createBuffer(
             tga::BufferInfo{tga::BufferUsage::uniform, tga::memoryAccess(uniformTerrainData), sizeof(TerrainData)});
+        createTerrainLod();
+
+        // The feedback pass renders into the virtual texture, so it has to exist before the render passes
+        grassImage = tga::loadImage(this->pathToTheTexture);
+        for (size_t i = 0; i < grassImage.data.size(); i += grassImage.components)
+            for (uint32_t c = 0; c < 3; c++)
+                grassAverage[c] += grassImage.data[i + std::min(c, grassImage.components - 1)];
+        grassAverage /= float(grassImage.width * grassImage.height);
+        terrainTexture = std::make_unique<tga::VirtualTexture>(
+            tgai, terrainTextureInfo, frameworkWindowResolution.x, frameworkWindowResolution.y,
+            [this](tga::VirtualPage page, std::vector<uint8_t>& rgba) { loadTerrainPage(page, rgba); });
 
-        terrainInputSet = tgai->createInputSet({terrainPass,1,{{uniformBuffer, 0},}});
-        tga::Texture texture =
-            loadTexture(this->pathToTheTexture, tga::Format::r32g32b32a32_sfloat, tga::SamplerMode::linear, tgai);
-        terrainInputSet = tgai->createInputSet({terrainPass, 1, {{uniformBuffer, 0}, {texture, 1}}});
+        /*TODO: Terrain Buffer Creation*/  //
+    }
 
-        // Shaders get backed into the renderpass, we don't need the modules anymore, so free them
-        tgai->free(terrainVS);
-        tgai->free(terrainFS);
+    // Height and normal textures of a heightmap generated on the CPU, generateTerrain writes them on the device
+    void uploadTerrainTextures()
+    {
+        std::vector<float> heights = heightmap.packed();
+        heightTexture = tgai->createTexture({uint32_t(heightmap.width), uint32_t(heightmap.height),
+                                             tga::Format::r32_sfloat, tga::memoryAccess(heights),
+                                             heights.size() * sizeof(float), tga::SamplerMode::linear,
+                                             tga::AddressMode::clampEdge});
+        // Two bytes per normal, half the size of the heights
+        std::vector<int8_t> normals(2 * size_t(heightmap.width) * heightmap.height);
+        generateNormalMap(heightmap, NormalEncoding::octahedral, normals.data(), &jobs);
+        normalTexture = tgai->createTexture({uint32_t(heightmap.width), uint32_t(heightmap.height),
+                                             tga::Format::r8g8_snorm, tga::memoryAccess(normals), normals.size(),
+                                             tga::SamplerMode::linear, tga::AddressMode::clampEdge});
+    }
 
-        /*TODO: Terrain Buffer Creation*/  //
+    /**
+     * @brief Creates the CDLOD renderer of the terrain
+     *
+     * All nodes share the index buffer of one small grid. The vertex shader pulls the grid position from the vertex
+     * index, places it with the node data and reads heights and normals from textures. Besides these textures the
+     * terrain needs no geometry memory. So the geometry drawn per frame depends on the view, not on the size of the
+     * heightmap. Nodes outside of the view frustum are culled before they are drawn.
+     */
+    void createTerrainLod()
+    {
+        // Same placement as terrain_proxy.vert, the heightmap spans -dimensions to dimensions in x and z
+        vec3 dimensions = uniformTerrain.dimensions;
+        terrainLod = std::make_unique<TerrainQuadtree>(uint32_t(heightmap.width - 1), terrainGridCells,
+                                                       vec3(-dimensions.x, 0, -dimensions.z),
+                                                       dimensions * vec3(2, 1, 2), heightmap.row(0),
+                                                       heightmap.stride());
+        terrainLod->setScreenError(glm::radians(camController->fov), float(frameworkWindowResolution.y),
+                                   terrainPixelError);
+
+        terrainGridIndices = tgai->createBuffer(
+            {tga::BufferUsage::index, nullptr, terrainLod->gridIndexCount() * sizeof(uint16_t)},
+            [&](uint8_t* data) { terrainLod->writeGridIndices(reinterpret_cast<uint16_t*>(data)); });
+        terrainNodeBuffer = tgai->createBuffer(
+            {tga::BufferUsage::storage, nullptr, terrainLod->maxSelection() * sizeof(TerrainNode)});
+    }
+
+    // Draws the nodes selected by the last terrainLod->select(), one instanced draw per part
+    void drawTerrain()
+    {
+        tgai->bindIndexBuffer(terrainGridIndices, tga::IndexType::uint16);
+        uint32_t quadrantIndices = terrainLod->gridIndexCount() / 4;
+        for (uint32_t part = 0; part < TerrainQuadtree::partCount; part++) {
+            auto batch = terrainLod->batch(TerrainQuadtree::Part(part));
+            if (batch.instanceCount == 0) continue;
+            if (part == TerrainQuadtree::whole)
+                tgai->drawIndexed(terrainLod->gridIndexCount(), 0, 0, batch.instanceCount, batch.firstInstance);
+            else
+                tgai->drawIndexed(quadrantIndices, (part - TerrainQuadtree::quadrant00) * quadrantIndices, 0,
+                                  batch.instanceCount, batch.firstInstance);
+        }
+    }
+
+    void createTerrainInputSets()
+    {
+        std::vector<tga::Binding> bindings{{uniformBuffer, 0},
+                                           {terrainTexture->cache, 1},
+                                           {terrainTexture->pageTable, 2},
+                                           {terrainTexture->parameterBuffer, 3},
+                                           {heightTexture, 4},
+                                           {terrainNodeBuffer, 5},
+                                           {normalTexture, 6}};
+        terrainInputSet = tgai->createInputSet({terrainPass, 1, bindings});
+        feedbackSystemInputSet = makeSystemInputSet(feedbackPass);
+        feedbackInputSet = tgai->createInputSet({feedbackPass, 1, bindings});
+    }
+
+    // Terrain data, the virtual terrain texture, the heightmap, the selected nodes and the normal map, shared by the
+    // terrain and the feedback pass
+    tga::SetLayout terrainSetLayout()
+    {
+        return {tga::BindingType::uniformBuffer, tga::BindingType::sampler, tga::BindingType::storageBuffer,
+                tga::BindingType::uniformBuffer, tga::BindingType::sampler, tga::BindingType::storageBuffer,
+                tga::BindingType::sampler};
+    }
+
+    // Synthesizes a page of the terrain texture: the grass texture repeated over the whole terrain, brightened with
+    // the height. Runs on the loader thread of the virtual texture and only reads data that never changes
+    void loadTerrainPage(tga::VirtualPage page, std::vector<uint8_t>& rgba)
+    {
+        int32_t border = int32_t(terrainTextureInfo.border);
+        int32_t pageSize = int32_t(terrainTextureInfo.contentSize) + 2 * border;
+        int32_t levelSize = int32_t(terrainTextureInfo.size >> page.level);
+        int32_t originX = int32_t(page.x * terrainTextureInfo.contentSize) - border;
+        int32_t originY = int32_t(page.y * terrainTextureInfo.contentSize) - border;
+        uint32_t side = uint32_t(heightmap.width);
+
+        // Texels of coarse levels cover many repetitions of the grass texture, they fade to its average color
+        float fade = std::min(1.f, float(page.level) / std::log2(float(std::max(grassImage.width, 2u))));
+
+        for (int32_t y = 0; y < pageSize; y++) {
+            for (int32_t x = 0; x < pageSize; x++) {
+                // The border is clamped at the edges of the texture, like the sampler would
+                uint32_t lx = uint32_t(std::clamp(originX + x, 0, levelSize - 1));
+                uint32_t ly = uint32_t(std::clamp(originY + y, 0, levelSize - 1));
+                uint32_t gx = (lx << page.level) % grassImage.width;
+                uint32_t gy = (ly << page.level) % grassImage.height;
+                uint8_t const* grass = &grassImage.data[(gy * grassImage.width + gx) * grassImage.components];
+
+                uint32_t hx = std::min(uint32_t((lx + 0.5f) / levelSize * side), side - 1);
+                uint32_t hy = std::min(uint32_t((ly + 0.5f) / levelSize * side), side - 1);
+                float shade = 0.75f + 0.5f * heightmap(int(hx), int(hy));
+
+                uint8_t* texel = &rgba[(size_t(y) * pageSize + x) * 4];
+                for (uint32_t c = 0; c < 3; c++) {
+                    float value = grass[std::min(c, grassImage.components - 1)];
+                    value = glm::mix(value, grassAverage[c], fade) * shade;
+                    texel[c] = uint8_t(std::min(value, 255.f));
+                }
+                texel[3] = 255;
+            }
+        }
     }
 
 
@@ -492,98 +889,32 @@ class Game : public Framework {
 
     void createEnemyResources()
     {
-        auto enemyVS = tga::loadShader("shaders/instances_vert.spv", tga::ShaderType::vertex, tgai);
-        auto enemyFS = tga::loadShader("shaders/phong_frag.spv", tga::ShaderType::fragment, tgai);
-        this->enemy = tga::loadObj("resources/Enemies/amy/amy.obj");
-        VertexLayout enemyVertexLayout = tga::Vertex::layout();
-        this->enemyPass = tgai->createRenderPass(
-            {{enemyVS, enemyFS},
-             frameworkWindow,
-             tga::ClearOperation::depth,
-             {tga::FrontFace::counterclockwise, tga::CullMode::none},
-             {tga::CompareOperation::less},
-             {{
-                  /*Set 0: Three uniform Buffers for the System Input*/
-                  {tga::BindingType::uniformBuffer, tga::BindingType::uniformBuffer, tga::BindingType::uniformBuffer},
-
-                  /*Set 1: Terrain Data*/
-                  {tga::BindingType::sampler, tga::BindingType::sampler, tga::BindingType::sampler,
-                   tga::BindingType::uniformBuffer, tga::BindingType::storageBuffer},
-              }},
-             enemyVertexLayout});
-
-        this->enemyVertex =
-            tgai->createBuffer(tga::BufferInfo{tga::BufferUsage::vertex, tga::memoryAccess(this->enemy.vertexBuffer),
-                                               this->enemy.vertexBuffer.size() * sizeof(tga::Vertex)});
-
+        auto packedEnemy = tga::packObj(*this->enemy, tga::PositionEncoding::unorm16);
+        this->enemyDequantization = packedEnemy.dequantization();
+        this->enemyRange = meshArena.add(packedEnemy);
 
-        this->enemyIndex = tgai->createBuffer(tga::BufferInfo{tga::BufferUsage::index, tga::memoryAccess(this->enemy.indexBuffer),
-                                                              this->enemy.indexBuffer.size() * sizeof(glm::uint32_t)});
 
 
 
 
-
-        transformations[0] = glm::translate(glm::mat4(1.0f), glm::vec3(5, 2, 8)) *
-                             glm::scale(glm::mat4(1.0f), glm::vec3(0.002, 0.002, 0.002)) *
-                             glm::rotate(glm::mat4(1.0f), 3.14f, glm::vec3(1, 0, 0)) *
-                             glm::rotate(glm::mat4(1.0f), -1.14f, glm::vec3(0, 1, 0));
-
-
-
-        transformations[0] = glm::translate(glm::mat4(1.0f), generateTranslationVector(0)) *
-                             glm::scale(glm::mat4(1.0f), glm::vec3(0.002, 0.002, 0.002)) *
-                             glm::rotate(glm::mat4(1.0f), 3.14f, glm::vec3(1, 0, 0)) *
-                             glm::rotate(glm::mat4(1.0f), -1.14f, glm::vec3(0, 1, 0));
-
-        transformations[1] = glm::translate(glm::mat4(1.0f), generateTranslationVector(27)) *
-                             glm::scale(glm::mat4(1.0f), glm::vec3(0.002, 0.002, 0.002)) *
-                             glm::rotate(glm::mat4(1.0f), 3.14f, glm::vec3(1, 0, 0));
-        transformations[2] = glm::translate(glm::mat4(1.0f), generateTranslationVector(5.5)) *
-                             glm::scale(glm::mat4(1.0f), glm::vec3(0.002, 0.002, 0.002)) *
-                             glm::rotate(glm::mat4(1.0f), 3.14f, glm::vec3(1, 0, 0)) *
-                             glm::rotate(glm::mat4(1.0f), 1.14f, glm::vec3(0, 1, 0));
-        transformations[3] = glm::translate(glm::mat4(1.0f), generateTranslationVector(3)) *
-                             glm::scale(glm::mat4(1.0f), glm::vec3(0.002, 0.002, 0.002)) *
-                             glm::rotate(glm::mat4(1.0f), 3.14f, glm::vec3(1, 0, 0)) *
-                             glm::rotate(glm::mat4(1.0f), 12.44f, glm::vec3(0, 1, 0));
-        transformations[4] = glm::translate(glm::mat4(1.0f), generateTranslationVector(150)) *
-                             glm::scale(glm::mat4(1.0f), glm::vec3(0.002, 0.002, 0.002)) *
-                             glm::rotate(glm::mat4(1.0f), 3.14f, glm::vec3(1, 0, 0)) *
-                             glm::rotate(glm::mat4(1.0f), 2.04f, glm::vec3(0, 1, 0));
-        transformations[5] = glm::translate(glm::mat4(1.0f), generateTranslationVector(6)) *
-                             glm::scale(glm::mat4(1.0f), glm::vec3(0.002, 0.002, 0.002)) *
-                             glm::rotate(glm::mat4(1.0f), 3.14f, glm::vec3(1, 0, 0)) *
-                             glm::rotate(glm::mat4(1.0f), 2.04f, glm::vec3(0, 1, 0));
-
-
-
-
-        for(int i = 0; i < 6; i++){
-            boundingSpheres[i] = createBoundingSphere(enemy.vertexBuffer);
-            boundingSpheres[i].center = transformations[i] * boundingSpheres[i].center;
+        // Spawn points around the terrain, every enemy keeps its own heading
+        float spawnAngles[6] = {0, 27, 5.5, 3, 150, 6};
+        float headings[6] = {-1.14f, 0, 1.14f, 12.44f, 2.04f, 2.04f};
+        for (int i = 0; i < 6; i++) {
+            enemyPositions[i] = generateTranslationVector(spawnAngles[i]);
+            enemyOrientations[i] = glm::scale(glm::mat4(1.0f), glm::vec3(0.002, 0.002, 0.002)) *
+                                   glm::rotate(glm::mat4(1.0f), 3.14f, glm::vec3(1, 0, 0)) *
+                                   glm::rotate(glm::mat4(1.0f), headings[i], glm::vec3(0, 1, 0));
         }
 
+        // The scene nodes carry the dequantization, so the bounds are moved into the quantized space as well
+        enemyBounds = createBoundingSphere(enemy->vertexBuffer);
+        enemyBounds.center = glm::inverse(enemyDequantization) * enemyBounds.center;
 
-        enemyStorage = tgai->createBuffer(
-            tga::BufferInfo{tga::BufferUsage::storage, tga::memoryAccess(transformations), 6 * sizeof(mat4x4)});
-
-        tga::Texture texture_dif = loadTexture("resources/Enemies/amy/amy_diffuse.png",
-                                               tga::Format::r32g32b32a32_sfloat, tga::SamplerMode::linear, tgai);
-        tga::Texture texture_em = loadTexture("resources/Enemies/amy/amy_emission.png",
-                                              tga::Format::r32g32b32a32_sfloat, tga::SamplerMode::linear, tgai);
-        tga::Texture texture_spec = loadTexture("resources/Enemies/amy/amy_specular.png",
-                                                tga::Format::r32g32b32a32_sfloat, tga::SamplerMode::linear, tgai);
-
-        this->meshCockpitUniformBuffer = tgai->createBuffer(
-            tga::BufferInfo{tga::BufferUsage::uniform, tga::memoryAccess(camController->position), sizeof(vec3)});
-        enemyInputSet = tgai->createInputSet(
-            {enemyPass,
-             1,
-             { {texture_dif, 0}, {texture_em, 1}, {texture_spec, 2}, {meshCockpitUniformBuffer, 3},{enemyStorage, 4}}});
-
-        tgai->free(enemyVS);
-        tgai->free(enemyFS);
+        // Both ends of the interpolation start at the spawn positions
+        EnemySnapshot spawn{0, {}};
+        std::copy(std::begin(enemyPositions), std::end(enemyPositions), spawn.positions.begin());
+        previousEnemies = currentEnemies = spawn;
     }
 
 
@@ -591,311 +922,306 @@ class Game : public Framework {
 
 
 
-    void createMeshResources() {
-        auto meshVS = tga::loadShader("shaders/phong_vert.spv", tga::ShaderType::vertex, tgai);
-        auto meshFS = tga::loadShader("shaders/phong_frag.spv", tga::ShaderType::fragment, tgai);
-
-        this->mesh = tga::loadObj("resources/Cockpit/cockpit/cockpit.obj");
-        this->meshGunGatling = tga::loadObj("resources/Cockpit/gatling_gun/gatling_gun_barrel.obj");
-        this->meshGunGatlingBase = tga::loadObj("resources/Cockpit/gatling_gun/gatling_gun_base.obj");
-        this->meshGunPlasma = tga::loadObj("resources/Cockpit/plasma_gun/plasma_gun_barrel.obj");
-        this->meshGunPlasmaBase = tga::loadObj("resources/Cockpit/plasma_gun/plasma_gun_base.obj");
-        tga::VertexLayout meshVertexLayout{
-            /*Size of a single Vertex, vec4 position, vec3 normal, vec2 textureCoordinates*/
-            (sizeof(tga::Vertex)),
-            {
-                /*{offset in bytes from start of a vector, Format of the component}*/
-                {offsetof(tga::Vertex, position), tga::Format::r32g32b32_sfloat}, /* Position x,y,z */
-                {offsetof(tga::Vertex, uv), tga::Format::r32g32_sfloat},     /* Texture Coordinates x,y*/
-                {offsetof(tga::Vertex, normal), tga::Format::r32g32b32_sfloat},   /* Normal x,y,z*/
-                {offsetof(tga::Vertex, tangent), tga::Format::r32g32b32_sfloat} /*Tangent x, y, x */
-            }};
-        this->meshPass = tgai->createRenderPass(
-            {{meshVS, meshFS},
-             frameworkWindow,
-             tga::ClearOperation::depth,
-             {tga::FrontFace::counterclockwise,tga::CullMode::none},
-             {tga::CompareOperation::less},
-             {{/*Set 0: Three uniform Buffers for the System Input*/
-                  {tga::BindingType::uniformBuffer, tga::BindingType::uniformBuffer, tga::BindingType::uniformBuffer},
-
-                  /*Set 1: Terrain Data*/
-                  {tga::BindingType::sampler, tga::BindingType::sampler, tga::BindingType::sampler, tga::BindingType::uniformBuffer, tga::BindingType::uniformBuffer /*TODO: Declare more Bindings for your Shader here*/},
-              }},
-             meshVertexLayout});
-
-
-        // mesh for cockpit
-        this->meshVertexBuffer = tgai->createBuffer(
-            tga::BufferInfo{tga::BufferUsage::vertex, tga::memoryAccess(this->mesh.vertexBuffer), this->mesh.vertexBuffer.size() * sizeof(tga::Vertex)});
-
-        this->meshIndexBuffer = tgai->createBuffer(
-            tga::BufferInfo{tga::BufferUsage::index, tga::memoryAccess(mesh.indexBuffer), mesh.indexBuffer.size() * sizeof(glm::uint32_t)});
-
-        this->meshUniformBuffer = tgai->createBuffer(
-            tga::BufferInfo{tga::BufferUsage::uniform, tga::memoryAccess(camController->position), sizeof(vec3)});
-
-        mat4 mat = mat4(1, 0, 0, 0,
-                        0, 1, 0, 0,
-                        0, 0, 1, 0,
-                        0, -0.8, -1.6, 1);
-        this->matrixBuffer = tgai->createBuffer(
-            tga::BufferInfo{tga::BufferUsage::uniform, tga::memoryAccess(mat), sizeof(mat4)});
-        // mesh for gatling
-
-        //Gatling
-        for(tga::Vertex vertex: this->meshGunGatling.vertexBuffer) {
-            vertex.position += vec3(3.0, 0.0, 0.0);
-        }
+    tga::MeshRange addPackedMesh(tga::Obj const& obj)
+    {
+        return meshArena.add(tga::packObj(obj, tga::PositionEncoding::sfloat16));
+    }
 
-        //Base Gatling
-        for(tga::Vertex vertex: this->meshGunGatlingBase.vertexBuffer) {
-            vertex.position += vec3(3.0, 0.0, 0.0);
+    /*
+     * Every enemy is a moving node with its model below it, the model node folds in the orientation and the
+     * dequantization of the enemy vertices. The cockpit and both guns hang below a rig in view space, barrel and base
+     * of a gun share the gun node. Each node owns the DrawData entry with its index, pivots are never drawn
+     */
+    void createScene()
+    {
+        for (int i = 0; i < 6; i++) {
+            enemyNodes[i] = scene.add(glm::translate(glm::mat4(1.0f), enemyPositions[i]));
+            enemyModels[i] = scene.add(enemyOrientations[i] * enemyDequantization, enemyNodes[i]);
         }
-
-        for(tga::Vertex vertex: this->meshGunPlasma.vertexBuffer) {
-            vertex.position += vec3(-3.0, 0.0, 0.0);
+        auto rig = scene.add(glm::mat4(1.0f));
+        auto cockpit = scene.add(glm::translate(glm::mat4(1.0f), glm::vec3(0, -0.8, -1.6)), rig);
+        auto gatling = scene.add(glm::translate(glm::mat4(1.0f), glm::vec3(2.6, -0.2, -2)), rig);
+        auto gatlingBarrel = scene.add(glm::mat4(1.0f), gatling);
+        auto gatlingBase = scene.add(glm::mat4(1.0f), gatling);
+        auto plasma = scene.add(glm::translate(glm::mat4(1.0f), glm::vec3(-2.6, -0.2, -2)), rig);
+        auto plasmaBarrel = scene.add(glm::mat4(1.0f), plasma);
+        auto plasmaBase = scene.add(glm::mat4(1.0f), plasma);
+
+        sceneDrawData.resize(scene.size());
+        for (auto model : enemyModels) sceneDrawData[model].material = enemyMaterial;
+        sceneDrawData[cockpit].material = cockpitMaterial;
+        sceneDrawData[gatlingBarrel].material = sceneDrawData[gatlingBase].material = gatlingMaterial;
+        sceneDrawData[plasmaBarrel].material = sceneDrawData[plasmaBase].material = plasmaMaterial;
+        updateScene();
+        sceneBuffer = tgai->createBuffer({tga::BufferUsage::storage, tga::memoryAccess(sceneDrawData),
+                                          sceneDrawData.size() * sizeof(DrawData)});
+
+        occlusionProxyInputSet = tgai->createInputSet({occlusionProxyPass, 1, {{sceneBuffer, 0}}});
+
+        meshDraws = {{cockpitRange, cockpit, cockpitMaterial},
+                     {gatlingRange, gatlingBarrel, gatlingMaterial},
+                     {gatlingBaseRange, gatlingBase, gatlingMaterial},
+                     {plasmaRange, plasmaBarrel, plasmaMaterial},
+                     {plasmaBaseRange, plasmaBase, plasmaMaterial}};
+        for (auto& draw : meshDraws) meshBatch.add(draw.range, 1, draw.node);
+        meshBatch.upload(tgai);
+
+        if (tgai->bindlessSupported()) {
+            enemyInputSet = tgai->createInputSet({enemyPass, 1, materialBindings(sceneBuffer)});
+            meshInputSet = tgai->createInputSet({meshPass, 1, materialBindings(sceneBuffer)});
+        } else {
+            enemyInputSet = tgai->createInputSet({enemyPass, 1, materialBindings(sceneBuffer, enemyMaterial)});
+            for (uint32_t material = 0; material < materialTextures.size() / 3; material++)
+                meshMaterialInputSets.push_back(
+                    tgai->createInputSet({meshPass, 1, materialBindings(sceneBuffer, material)}));
         }
+    }
 
-        //Plasma Base
-        for(tga::Vertex vertex: this->meshGunPlasmaBase.vertexBuffer) {
-            vertex.position += vec3(-3.0, 0.0, 0.0);
+    // Only the subtrees that moved are recomputed and uploaded
+    void updateScene()
+    {
+        for (auto [first, last] : scene.update()) {
+            for (auto node = first; node < last; node++) sceneDrawData[node].transform = scene.world(node);
+            if (sceneBuffer)
+                tgai->updateBuffer(sceneBuffer, tga::memoryAccess(sceneDrawData[first]),
+                                   (last - first) * sizeof(DrawData), uint32_t(first * sizeof(DrawData)));
         }
+    }
 
+    // Loads the diffuse, emission and specular texture of a material, the shaders expect them in this order
+    uint32_t loadMaterial(std::string const& basePath)
+    {
+        uint32_t material = uint32_t(materialTextures.size() / 3);
+        if (materialTextures.size() + 3 > maxMaterialTextures)
+            throw std::runtime_error("Too many materials for the material texture array");
+        for (auto suffix : {"_diffuse.png", "_emission.png", "_specular.png"})
+            materialTextures.push_back(
+                assets.texture(basePath + suffix, tga::Format::r32g32b32a32_sfloat, tga::SamplerMode::linear));
+        return material;
+    }
 
-
-        this->meshVertexBufferGatling = tgai->createBuffer(
-            tga::BufferInfo{tga::BufferUsage::vertex, tga::memoryAccess(this->meshGunGatling.vertexBuffer), this->meshGunGatling.vertexBuffer.size() * sizeof(tga::Vertex)});
-
-        this->meshIndexBufferGatling = tgai->createBuffer(
-            tga::BufferInfo{tga::BufferUsage::index, tga::memoryAccess(meshGunGatling.indexBuffer), meshGunGatling.indexBuffer.size() * sizeof(glm::uint32_t)});
-
-        this->meshUniformBufferGatling = tgai->createBuffer(
-            tga::BufferInfo{tga::BufferUsage::uniform, tga::memoryAccess(camController->position), sizeof(vec3)});
-
-        mat4 mat2 = mat4(1, 0, 0, 0,
-                         0, 1, 0, 0,
-                         0, 0, 1, 0,
-                         2.6, -0.2, -2, 1);
-        this->matrixBufferGatling = tgai->createBuffer(
-            tga::BufferInfo{tga::BufferUsage::uniform, tga::memoryAccess(mat2), sizeof(mat4)});
-
-
-
-        this->meshVertexBufferGatlingBase = tgai->createBuffer(
-            tga::BufferInfo{tga::BufferUsage::vertex, tga::memoryAccess(this->meshGunGatlingBase.vertexBuffer), this->meshGunGatlingBase.vertexBuffer.size() * sizeof(tga::Vertex)});
-
-        this->meshIndexBufferGatlingBase = tgai->createBuffer(
-            tga::BufferInfo{tga::BufferUsage::index, tga::memoryAccess(meshGunGatlingBase.indexBuffer), meshGunGatlingBase.indexBuffer.size() * sizeof(glm::uint32_t)});
-
-        this->meshUniformBufferGatlingBase = tgai->createBuffer(
-            tga::BufferInfo{tga::BufferUsage::uniform, tga::memoryAccess(camController->position), sizeof(vec3)});
-
-
-
-
-
-        this->meshVertexBufferPlasma = tgai->createBuffer(
-            tga::BufferInfo{tga::BufferUsage::vertex, tga::memoryAccess(this->meshGunPlasma.vertexBuffer), this->meshGunPlasma.vertexBuffer.size() * sizeof(tga::Vertex)});
-
-        this->meshIndexBufferPlasma = tgai->createBuffer(
-            tga::BufferInfo{tga::BufferUsage::index, tga::memoryAccess(meshGunPlasma.indexBuffer), meshGunPlasma.indexBuffer.size() * sizeof(glm::uint32_t)});
-
-        this->meshUniformBufferPlasma = tgai->createBuffer(
+    void createMaterialResources()
+    {
+        cockpitMaterial = loadMaterial("resources/Cockpit/cockpit/cockpit");
+        gatlingMaterial = loadMaterial("resources/Cockpit/gatling_gun/gatling_gun");
+        plasmaMaterial = loadMaterial("resources/Cockpit/plasma_gun/plasma_gun");
+        enemyMaterial = loadMaterial("resources/Enemies/amy/amy");
+        this->meshUniformBuffer = tgai->createBuffer(
             tga::BufferInfo{tga::BufferUsage::uniform, tga::memoryAccess(camController->position), sizeof(vec3)});
+    }
 
-        mat4 mat3 = mat4(1, 0, 0, 0,
-                         0, 1, 0, 0,
-                         0, 0, 1, 0,
-                         -2.6, -0.2, -2, 1);
-        this->matrixBufferPlasma = tgai->createBuffer(
-            tga::BufferInfo{tga::BufferUsage::uniform, tga::memoryAccess(mat3), sizeof(mat4)});
-
-
-        this->meshVertexBufferPlasmaBase = tgai->createBuffer(
-            tga::BufferInfo{tga::BufferUsage::vertex, tga::memoryAccess(this->meshGunPlasmaBase.vertexBuffer), this->meshGunPlasmaBase.vertexBuffer.size() * sizeof(tga::Vertex)});
+    // Fog constants of phong.frag, baked into the pipelines instead of being read at runtime
+    tga::SpecializationInfo fogSpecialization()
+    {
+        return tga::SpecializationInfo(tga::ShaderType::fragment).set(0, fogCutoff).set(1, fogDistance);
+    }
 
-        this->meshIndexBufferPlasmaBase = tgai->createBuffer(
-            tga::BufferInfo{tga::BufferUsage::index, tga::memoryAccess(meshGunPlasmaBase.indexBuffer), meshGunPlasmaBase.indexBuffer.size() * sizeof(glm::uint32_t)});
+    // All materials live in one bindless texture array, draws pick theirs with the material ID of their DrawData
+    tga::SetLayout materialSetLayout()
+    {
+        return {{tga::BindingType::sampler, maxMaterialTextures, true},
+                tga::BindingType::uniformBuffer,
+                tga::BindingType::storageBuffer};
+    }
 
-        this->meshUniformBufferPlasmaBase = tgai->createBuffer(
-            tga::BufferInfo{tga::BufferUsage::uniform, tga::memoryAccess(camController->position), sizeof(vec3)});
+    // Binds all materials, or only the textures of one material as the first elements for phong_fixed.frag
+    std::vector<tga::Binding> materialBindings(tga::Buffer drawData, uint32_t material = allMaterials)
+    {
+        std::vector<tga::Binding> bindings{{meshUniformBuffer, 1}, {drawData, 2}};
+        if (material == allMaterials)
+            for (uint32_t i = 0; i < materialTextures.size(); i++)
+                bindings.emplace_back(materialTextures[i]->texture, 0, i);
+        else
+            for (uint32_t i = 0; i < 3; i++) bindings.emplace_back(materialTextures[3 * material + i]->texture, 0, i);
+        return bindings;
+    }
 
+    void createMeshResources()
+    {
+        this->cockpitRange = addPackedMesh(*this->mesh);
+        this->gatlingRange = addPackedMesh(*this->meshGunGatling);
+        this->gatlingBaseRange = addPackedMesh(*this->meshGunGatlingBase);
+        this->plasmaRange = addPackedMesh(*this->meshGunPlasma);
+        this->plasmaBaseRange = addPackedMesh(*this->meshGunPlasmaBase);
+    }
 
-        // textures for cockpit
-        tga::Texture texture_dif =
-            loadTexture(
-                "resources/Cockpit/cockpit/cockpit_diffuse.png", tga::Format::r32g32b32a32_sfloat, tga::SamplerMode::linear, tgai);
-        tga::Texture texture_em =
-            loadTexture(
-                "resources/Cockpit/cockpit/cockpit_emission.png", tga::Format::r32g32b32a32_sfloat,
-                tga::SamplerMode::linear, tgai);
-        tga::Texture texture_spec =
-            loadTexture(
-                "resources/Cockpit/cockpit/cockpit_specular.png", tga::Format::r32g32b32a32_sfloat,
-                tga::SamplerMode::linear, tgai);
-        meshInputSet = tgai->createInputSet({meshPass, 1, {{texture_dif, 0}, {texture_em, 1}, {texture_spec, 2} ,{meshUniformBuffer, 3}, {matrixBuffer, 4}}});
-
-        // textures for gatling
-        tga::Texture texture_dif_gatling =
-            loadTexture(
-                "resources/Cockpit/gatling_gun/gatling_gun_diffuse.png", tga::Format::r32g32b32a32_sfloat, tga::SamplerMode::linear, tgai);
-        tga::Texture texture_em_gatling =
-            loadTexture(
-                "resources/Cockpit/gatling_gun/gatling_gun_emission.png", tga::Format::r32g32b32a32_sfloat,
-                tga::SamplerMode::linear, tgai);
-        tga::Texture texture_spec_gatling =
-            loadTexture(
-                "resources/Cockpit/gatling_gun/gatling_gun_specular.png", tga::Format::r32g32b32a32_sfloat,
-                tga::SamplerMode::linear, tgai);
-        meshInputSetGatling = tgai->createInputSet({meshPass, 1, {{texture_dif_gatling, 0}, {texture_em_gatling, 1}, {texture_spec_gatling, 2} ,{meshUniformBufferGatling, 3}, {matrixBufferGatling, 4}}});
-
-
-        //textures for plasma
-        tga::Texture texture_dif_plasma =
-            loadTexture(
-                "resources/Cockpit/plasma_gun/plasma_gun_diffuse.png", tga::Format::r32g32b32a32_sfloat, tga::SamplerMode::linear, tgai);
-        tga::Texture texture_em_plasma =
-            loadTexture(
-                "resources/Cockpit/plasma_gun/plasma_gun_emission.png", tga::Format::r32g32b32a32_sfloat,
-                tga::SamplerMode::linear, tgai);
-        tga::Texture texture_spec_plasma =
-            loadTexture(
-                "resources/Cockpit/plasma_gun/plasma_gun_specular.png", tga::Format::r32g32b32a32_sfloat,
-                tga::SamplerMode::linear, tgai);
-        meshInputSetPlasma = tgai->createInputSet({meshPass, 1, {{texture_dif_plasma, 0}, {texture_em_plasma, 1}, {texture_spec_plasma, 2} ,{meshUniformBufferPlasma, 3}, {matrixBufferPlasma, 4}}});
-
-
-
-        // Shaders get backed into the renderpass, we don't need the modules anymore, so free them
-        tgai->free(meshVS);
-        tgai->free(meshFS);
+    // Parsing the obj files only touches the CPU, so it runs on the workers while the terrain is generated
+    void loadModels(JobSystem::Counter& counter)
+    {
+        std::pair<std::shared_ptr<tga::Obj const>*, char const*> models[] = {
+            {&enemy, "resources/Enemies/amy/amy.obj"},
+            {&mesh, "resources/Cockpit/cockpit/cockpit.obj"},
+            {&meshGunGatling, "resources/Cockpit/gatling_gun/gatling_gun_barrel.obj"},
+            {&meshGunGatlingBase, "resources/Cockpit/gatling_gun/gatling_gun_base.obj"},
+            {&meshGunPlasma, "resources/Cockpit/plasma_gun/plasma_gun_barrel.obj"},
+            {&meshGunPlasmaBase, "resources/Cockpit/plasma_gun/plasma_gun_base.obj"}};
+        for (auto [model, path] : models) jobs.run([this, model, path] { *model = assets.obj(path); }, &counter);
     }
 
     void OnCreate() override
     {
-        createBackgroundResources();
+        // The loads write into members and the counter, they must be done before an exception leaves OnCreate
+        JobSystem::Counter modelsLoaded;
+        JobSystem::ScopedWait modelsGuard(jobs, modelsLoaded);
+        loadModels(modelsLoaded);
         createTerrainResources();
+        createRenderPasses();
+        createBackgroundResources();
+        createTerrainInputSets();
+        createMaterialResources();
+        jobs.wait(modelsLoaded);
         createEnemyResources();
         createMeshResources();
+        meshArena.upload(tgai);
+        createScene();
+        occlusionQueries = tgai->createQueryPool({6});
+        // Everything is on the GPU now, releasing the objs lets the cache drop them
+        for (auto model : {&enemy, &mesh, &meshGunGatling, &meshGunGatlingBase, &meshGunPlasma, &meshGunPlasmaBase})
+            model->reset();
         this->camController->position = glm::vec3(0.0, 14.0f, 28.0f);
 //        this->camController->position = glm::vec3(0.0, 5.0f, 5.0f);
+        cameraInput.write() = camController->position;
+        cameraInput.publish();
+        simulationThread = true;
     }
 
-    void OnFixedUpdate() override {}
-
-    glm::vec3 generateTranslationVector(float alpha) {
-        return terrainCenter + terrainRadius * vec3(sin(alpha), 1, cos(alpha));
-    }
-
-    void OnUpdate(uint32_t backbufferIndex) override
+    // Runs on the simulation thread, it only sees the camera through cameraInput and only hands out enemySnapshots
+    void OnFixedUpdate() override
     {
+        cameraInput.update();
+        vec3 cameraPosition = cameraInput.read();
 
         for(int i = 0; i < 6; i++) {
-            float distance = length(vec3(transformations[i][3][0], transformations[i][3][1], transformations[i][3][2]) - terrainCenter);
+            float distance = length(enemyPositions[i] - terrainCenter);
             if(distance > terrainRadius + 5){
-                transformations[i] = glm::translate(glm::mat4(1.0f), generateTranslationVector(i)) *
-                                     glm::scale(glm::mat4(1.0f), glm::vec3(0.002, 0.002, 0.002)) *
-                                     glm::rotate(glm::mat4(1.0f), 3.14f, glm::vec3(1, 0, 0)) *
-                                     glm::rotate(glm::mat4(1.0f), -1.14f, glm::vec3(0, 1, 0));
-
+                enemyPositions[i] = generateTranslationVector(i);
             }
             else{
-                speeds[i] = vec4(camController->position, 0) - transformations[i][3];
-
-                mat4 translation = glm::translate(glm::mat4(1.0f), vec3(speeds[i].x * (deltaTime/10), speeds[i].y * (deltaTime/10), speeds[i].z * (deltaTime/10)));
-                transformations[i] = translation *  transformations[i];
+                speeds[i] = vec4(cameraPosition - enemyPositions[i], 0);
+                enemyPositions[i] += vec3(speeds[i]) * float(fixedTimestep / 10);
             }
         }
 
+        auto& snapshot = enemySnapshots.write();
+        snapshot.time = simulationTime;
+        std::copy(std::begin(enemyPositions), std::end(enemyPositions), snapshot.positions.begin());
+        enemySnapshots.publish();
+    }
 
+    // Renders one tick behind the simulation, so there are two snapshots around the render time to blend
+    void interpolateEnemies()
+    {
+        if (enemySnapshots.update()) {
+            previousEnemies = currentEnemies;
+            currentEnemies = enemySnapshots.read();
+        }
+        double renderTime = totalElapsedTime - fixedTimestep;
+        double span = currentEnemies.time - previousEnemies.time;
+        float alpha = span > 0 ? float(glm::clamp((renderTime - previousEnemies.time) / span, 0., 1.)) : 1.f;
+        // Enemies only move, the orientation lives in the model nodes below
+        for (int i = 0; i < 6; i++) {
+            vec3 position = glm::mix(previousEnemies.positions[i], currentEnemies.positions[i], alpha);
+            scene.setLocal(enemyNodes[i], glm::translate(glm::mat4(1.0f), position));
+        }
+    }
 
+    glm::vec3 generateTranslationVector(float alpha) {
+        return terrainCenter + terrainRadius * vec3(sin(alpha), 1, cos(alpha));
+    }
 
-        vector<mat4x4> newTransformations;
+    void OnUpdate(uint32_t backbufferIndex) override
+    {
+        // The readback stalls, so the feedback is only rendered and read every few frames
+        if (totalFrameCount % feedbackInterval == 0) terrainTexture->readFeedback();
+        terrainTexture->update();
+        bool renderFeedback = (totalFrameCount + 1) % feedbackInterval == 0;
+
+        cameraInput.write() = camController->position;
+        cameraInput.publish();
+        interpolateEnemies();
+        updateScene();
 
         vec4 normal = normalize(this->camController->getCamera().view[2]);
-        int counter = 6;
-        int lastIndex = 5;
         for(int i = 0; i < 6; i++) {
-            mat4 translation = glm::translate(glm::mat4(1.0f), vec3(speeds[i].x * (deltaTime/10), speeds[i].y * (deltaTime/10), speeds[i].z * (deltaTime/10)));
-            boundingSpheres[i].center = translation * boundingSpheres[i].center;
+            boundingSpheres[i] = enemyBounds;
+            boundingSpheres[i].center = scene.world(enemyModels[i]) * enemyBounds.center;
             vec4 pp = boundingSpheres[i].center - vec4(this->camController.get()->position, 0);
             float distance = dot(normal, pp);
-            if(distance < 0 && boundingSpheres[i].radius < distance){
-                counter--;
-                mat4 temp = transformations[lastIndex];
-                transformations[lastIndex] = transformations[i];
-                transformations[i] = temp;
-                lastIndex--;
-            }
+            enemyVisible[i] = !(distance < 0 && boundingSpheres[i].radius < distance);
+
+            // The near plane clips the box of an enemy right in front of the camera, so those skip the test
+            glm::mat4 model = scene.world(enemyModels[i]);
+            vec3 local = vec3(glm::inverse(model) * vec4(camController->position, 1));
+            vec3 closest = vec3(model * vec4(glm::clamp(local, 0.f, 1.f), 1));
+            enemyOcclusionTested[i] = glm::distance(closest, camController->position) > occlusionProxyMargin;
         }
         /*TODO: Update Data here*/
+        auto& terrainNodes = terrainLod->select(camController->position, camController->getFrustumPlanes());
+        if (!terrainNodes.empty())
+            tgai->updateBuffer(terrainNodeBuffer, reinterpret_cast<uint8_t const*>(terrainNodes.data()),
+                               terrainNodes.size() * sizeof(TerrainNode), 0);
         tgai->beginCommandBuffer(cmdBuffer);
-
+        // Publishes the results of the last frame to the conditional draws of this one
+        tgai->resetQueries(occlusionQueries);
+
+        if (renderFeedback) {
+            tgai->setRenderPass(feedbackPass, 0);
+            tgai->bindInputSet(feedbackSystemInputSet);
+            tgai->bindInputSet(feedbackInputSet);
+            drawTerrain();
+        }
 
         tgai->setRenderPass(backgroundPass, backbufferIndex);
         tgai->bindInputSet(systemInputSet);
         tgai->draw(3, 0);
-        tgai->setRenderPass(enemyPass, backbufferIndex);
-        tgai->bindVertexBuffer(this->enemyVertex);
-        tgai->bindIndexBuffer(this->enemyIndex);
-        tgai->bindInputSet(enemyInputSet);
-        tgai->drawIndexed(this->enemy.indexBuffer.size(), this->enemy.indexBuffer[0], 0, counter, 0);
-
-        tgai->updateBuffer(enemyStorage, memoryAccess(transformations), 6 * sizeof(mat4), 0);
-
         /*TODO: Record you commands here*/
         tgai->setRenderPass(terrainPass, backbufferIndex);
-        tgai->bindVertexBuffer(this->vertexBuffer);
-        tgai->bindIndexBuffer(this->indexBuffer);
         tgai->bindInputSet(terrainInputSet);
-        tgai->drawIndexed(this->index.size(),this->index[0] , 0);
-
-        tgai->setRenderPass(meshPass, backbufferIndex);
-
-        //gatling
-        tgai->setRenderPass(meshPass, backbufferIndex);
-        tgai->bindVertexBuffer(this->meshVertexBufferGatling);
-        tgai->bindIndexBuffer(this->meshIndexBufferGatling);
-        tgai->bindInputSet(meshInputSetGatling);
-        tgai->drawIndexed(this->meshGunGatling.indexBuffer.size(),this->meshGunGatling.indexBuffer[0], 0);
-
-        tgai->setRenderPass(meshPass, backbufferIndex);
-        tgai->bindVertexBuffer(this->meshVertexBufferGatlingBase);
-        tgai->bindIndexBuffer(this->meshIndexBufferGatlingBase);
-        tgai->bindInputSet(meshInputSetGatling);
-        tgai->drawIndexed(this->meshGunGatlingBase.indexBuffer.size(),this->meshGunGatlingBase.indexBuffer[0], 0);
-
+        drawTerrain();
+
+        // The bounding boxes of the enemies are tested against the terrain every frame without writing anything.
+        // The result reaches the conditional draws of the next frame, so an enemy appears one frame late at most
+        tgai->setRenderPass(occlusionProxyPass, backbufferIndex);
+        tgai->bindInputSet(occlusionProxyInputSet);
+        for (uint32_t i = 0; i < 6; i++) {
+            if (!enemyVisible[i]) continue;
+            tgai->beginOcclusionQuery(occlusionQueries, i);
+            tgai->draw(36, 0, 1, enemyModels[i]);
+            tgai->endOcclusionQuery(occlusionQueries, i);
+        }
 
-        //plasma
-        tgai->setRenderPass(meshPass, backbufferIndex);
-        tgai->bindVertexBuffer(this->meshVertexBufferPlasma);
-        tgai->bindIndexBuffer(this->meshIndexBufferPlasma);
-        tgai->bindInputSet(meshInputSetPlasma);
-        tgai->drawIndexed(this->meshGunPlasma.indexBuffer.size(),this->meshGunPlasma.indexBuffer[0], 0);
+        // The enemies keep the depth of the terrain, so the terrain can hide them
+        tgai->setRenderPass(enemyPass, backbufferIndex);
+        meshArena.bind(tgai);
+        tgai->bindInputSet(enemyInputSet);
+        for (uint32_t i = 0; i < 6; i++) {
+            if (!enemyVisible[i]) continue;
+            if (enemyOcclusionTested[i]) tgai->beginConditionalRendering(occlusionQueries, i);
+            tgai->drawIndexed(enemyRange.indexCount, enemyRange.firstIndex, enemyRange.vertexOffset, 1,
+                              enemyModels[i]);
+            if (enemyOcclusionTested[i]) tgai->endConditionalRendering();
+        }
 
+        // The cockpit and both guns share the arena buffers, one input set and one indirect draw. Without bindless
+        // support every draw binds the input set of its material
         tgai->setRenderPass(meshPass, backbufferIndex);
-        tgai->bindVertexBuffer(this->meshVertexBufferPlasmaBase);
-        tgai->bindIndexBuffer(this->meshIndexBufferPlasmaBase);
-        tgai->bindInputSet(meshInputSetPlasma);
-        tgai->drawIndexed(this->meshGunPlasmaBase.indexBuffer.size(),this->meshGunPlasmaBase.indexBuffer[0], 0);
-
-
-        //cockpit
-        tgai->bindVertexBuffer(this->meshVertexBuffer);
-        tgai->bindIndexBuffer(this->meshIndexBuffer);
-        tgai->bindInputSet(meshInputSet);
-        tgai->drawIndexed(this->mesh.indexBuffer.size(),this->mesh.indexBuffer[0], 0);
-
-
+        meshArena.bind(tgai);
+        if (tgai->bindlessSupported()) {
+            tgai->bindInputSet(meshInputSet);
+            meshBatch.draw(tgai);
+        } else {
+            for (auto& draw : meshDraws) {
+                tgai->bindInputSet(meshMaterialInputSets[draw.material]);
+                tgai->drawIndexed(draw.range.indexCount, draw.range.firstIndex, draw.range.vertexOffset, 1, draw.node);
+            }
+        }
 
         cmdBuffer = tgai->endCommandBuffer();
         tgai->execute(cmdBuffer);
     }
-    void OnDestroy() override {}
+    void OnDestroy() override { materialTextures.clear(); }
 
 
-    glm::vec4 speeds[6];
     tga::CommandBuffer cmdBuffer;
     tga::InputSet systemInputSet;
     tga::RenderPass backgroundPass;
@@ -903,12 +1229,82 @@ class Game : public Framework {
     tga::RenderPass terrainPass;
     tga::RenderPass meshPass;
     tga::InputSet terrainInputSet;
+    // The CPU path builds the same heightmap with createHeightmap
+    static constexpr bool gpuTerrain = true;
+    tga::Texture heightTexture;
+    tga::Texture normalTexture;
+    std::unique_ptr<TerrainQuadtree> terrainLod;
+    static constexpr uint32_t terrainGridCells = 32;  // Cells per side of a node
+    static constexpr float terrainPixelError = 2;     // Largest size of a grid cell on the screen
+    tga::Buffer terrainGridIndices;
+    tga::Buffer terrainNodeBuffer;
+
+    // 16k x 16k virtual terrain texture streamed through a 24 x 24 page cache, about 40 MB of VRAM
+    tga::VirtualTextureInfo terrainTextureInfo{};
+    std::unique_ptr<tga::VirtualTexture> terrainTexture;
+    tga::Image grassImage;
+    glm::vec3 grassAverage{0};
+    static constexpr uint64_t feedbackInterval = 4;
+    tga::RenderPass feedbackPass;
+    tga::InputSet feedbackSystemInputSet;
+    tga::InputSet feedbackInputSet;
+
+    // One query per enemy, counting the samples of its bounding box
+    static constexpr float occlusionProxyMargin = 0.2f;  // Twice the near plane, closer boxes get clipped
+    tga::RenderPass occlusionProxyPass;
+    tga::InputSet occlusionProxyInputSet;
+    tga::QueryPool occlusionQueries;
 
     tga::RenderPass enemyPass;
     tga::InputSet enemyInputSet;
-    tga::Buffer enemyStorage;
-    glm::mat4x4 transformations[6];
+    uint32_t enemyMaterial = 0;
+
+    static constexpr uint32_t maxMaterialTextures = 64;  // Must match MAX_MATERIAL_TEXTURES in phong.frag
+    std::vector<std::shared_ptr<tga::TextureBundle const>> materialTextures;
+    uint32_t cockpitMaterial = 0;
+    uint32_t gatlingMaterial = 0;
+    uint32_t plasmaMaterial = 0;
+    static constexpr uint32_t allMaterials = ~0u;
+    std::vector<tga::InputSet> meshMaterialInputSets;  // Per material, only without bindless support
+
+    // Cockpit and guns, meshBatch holds the same draws
+    struct MeshDraw {
+        tga::MeshRange range;
+        SceneGraph::Node node;
+        uint32_t material;
+    };
+    std::vector<MeshDraw> meshDraws;
+
+    // Enemies and cockpit share one hierarchy and one DrawData buffer, see createScene
+    SceneGraph scene;
+    std::vector<DrawData> sceneDrawData;
+    tga::Buffer sceneBuffer;
+    SceneGraph::Node enemyNodes[6];
+    SceneGraph::Node enemyModels[6];
+
+    float fogCutoff = 150.f;
+    float fogDistance = 1000.f;
+    float cockpitScale = 0.05f;
+    // Simulation state, owned by OnFixedUpdate
+    glm::vec3 enemyPositions[6];
+    glm::vec4 speeds[6];
+
+    // Published by the simulation, interpolated by the renderer
+    struct EnemySnapshot {
+        double time;
+        std::array<glm::vec3, 6> positions;
+    };
+    TripleBuffer<EnemySnapshot> enemySnapshots;
+    TripleBuffer<glm::vec3> cameraInput;
+    EnemySnapshot previousEnemies{};
+    EnemySnapshot currentEnemies{};
+
+    glm::mat4 enemyOrientations[6];
+    glm::mat4 enemyDequantization{1};
+    BoundingSphere enemyBounds;
     BoundingSphere boundingSpheres[6];
+    bool enemyVisible[6] = {true, true, true, true, true, true};
+    bool enemyOcclusionTested[6] = {};
 
 };
 
@@ -916,7 +1312,8 @@ int main()
 {
     try {
         Game game;
-        game.run({0, 0}, tga::PresentMode::immediate);
+        // Mailbox doesn't tear, the cap keeps it from rendering frames the monitor never shows
+        game.run({0, 0}, tga::PresentMode::mailbox, 240., 1);
     } catch (const std::exception& e) {
         std::cerr << e.what() << '\n';
     }
@@ -30,14 +30,14 @@ layout(set = 0, binding = 2) uniform System{
 layout(location = 0) in vec3 vertex_position;
 layout(location = 1) in vec2 vertex_textureCoordinates;
 layout(location = 2) in vec3 vertex_normal;
-layout(location = 3) in vec3 vertex_tangent;
+layout(location = 3) in vec2 vertex_tangent; // octahedral encoded
 
 struct  MeshData {
     mat4 transform;
-
+    uint material;
 };
 
-layout(set = 1,binding = 4) readonly buffer Instances{
+layout(set = 1,binding = 2) readonly buffer Instances{
     MeshData meshes[];
 } instances;
 
@@ -48,11 +48,22 @@ layout (location = 0) out FragData{
     vec3 normal;
     vec3 tangent;
 } fragData;
+layout(location = 4) flat out uint material;
+
+// https://knarkowicz.wordpress.com/2014/04/16/octahedron-normal-vector-encoding/
+vec3 octahedralDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0)));
+    return normalize(n);
+}
 
 void main() {
     gl_Position = fragData.world_position = camera.projection * camera.view * instances.meshes[gl_InstanceIndex].transform * vec4(vertex_position, 1);
     fragData.uv = vertex_textureCoordinates;
     fragData.normal = vertex_normal;
-    fragData.tangent = vertex_tangent;
+    fragData.tangent = octahedralDecode(vertex_tangent);
+    material = instances.meshes[gl_InstanceIndex].material;
 
 }
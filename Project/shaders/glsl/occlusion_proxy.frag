@@ -0,0 +1,6 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Occlusion proxies only count the samples passing the depth test, nothing is written
+void main() {
+}
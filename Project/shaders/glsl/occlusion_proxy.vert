@@ -0,0 +1,30 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_KHR_vulkan_glsl: enable
+
+layout(set = 0, binding = 0) uniform Camera{
+    mat4 view;
+    mat4 projection;
+    mat4 toWorld;
+} camera;
+
+struct  MeshData {
+    mat4 transform;
+    uint material;
+};
+
+// Same draw data as instances.vert, the instance picks the node of the mesh
+layout(set = 1, binding = 0) readonly buffer Instances{
+    MeshData meshes[];
+} instances;
+
+// Corners of a box as bits of the index, two triangles per face
+const uint cubeCorners[36] = uint[](0, 2, 1, 1, 2, 3,  4, 5, 6, 5, 7, 6,  0, 1, 4, 1, 5, 4,
+                                    2, 6, 3, 3, 6, 7,  0, 4, 2, 2, 4, 6,  1, 3, 5, 3, 7, 5);
+
+// Draws the bounding box of a quantized mesh, the stored positions span the unit cube. Needs 36 vertices
+void main() {
+    uint corner = cubeCorners[gl_VertexIndex];
+    vec3 position = vec3(corner & 1, (corner >> 1) & 1, (corner >> 2) & 1);
+    gl_Position = camera.projection * camera.view * instances.meshes[gl_InstanceIndex].transform * vec4(position, 1);
+}
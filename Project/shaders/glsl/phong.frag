@@ -23,11 +23,14 @@ layout(set = 0, binding = 2) uniform System{
 } system;
 
 /*TODO: Shader Specific Data Here*/
+// Fog reaches the sky color at FOG_DISTANCE, beyond FOG_CUTOFF only the sky is drawn
+layout(constant_id = 0) const float FOG_CUTOFF = 150.0;
+layout(constant_id = 1) const float FOG_DISTANCE = 1000.0;
 
-layout(set = 1 , binding = 0) uniform sampler2D MyTexture_dif;
-layout (set = 1, binding = 1) uniform sampler2D MyTexture_em;
-layout(set = 1, binding = 2) uniform sampler2D MyTexture_spec;
-layout(set = 1, binding = 3) uniform CamController {
+// Every material owns three consecutive textures: diffuse, emission, specular
+const uint MAX_MATERIAL_TEXTURES = 64;
+layout(set = 1, binding = 0) uniform sampler2D materialTextures[MAX_MATERIAL_TEXTURES];
+layout(set = 1, binding = 1) uniform CamController {
     vec3 position;
 } camController;
 
@@ -37,15 +40,24 @@ layout(location = 0) in FragData{
     vec3 normal;
     vec3 tangent;
 } fragData;
+layout(location = 4) flat in uint material;
 
 layout(location = 0) out vec4 color;
 
+// Built a second time with FIXED_MATERIAL for devices that cannot index sampler arrays with dynamic values, then every
+// material has an input set of its own that holds its textures first
+#ifdef FIXED_MATERIAL
+const uint firstTexture = 0;
+#endif
+
 void main()
 {
-
-    vec4 objectColor_dif = texture(MyTexture_dif, fragData.uv);
-    vec4 objectColor_em = texture(MyTexture_em, fragData.uv);
-    vec4 objectColor_spec = texture(MyTexture_spec, fragData.uv);
+#ifndef FIXED_MATERIAL
+    uint firstTexture = 3 * material;
+#endif
+    vec4 objectColor_dif = texture(materialTextures[firstTexture], fragData.uv);
+    vec4 objectColor_em = texture(materialTextures[firstTexture + 1], fragData.uv);
+    vec4 objectColor_spec = texture(materialTextures[firstTexture + 2], fragData.uv);
     vec3 normal = normalize(vec3(fragData.normal.x, fragData.normal.z, fragData.normal.y));
     vec3 lightDir = normalize(light.direction);
     vec4 reflectDir = vec4(reflect(-lightDir, normal), 1.0);
@@ -59,8 +71,8 @@ void main()
     vec4 specular = (0.2 * spec * objectColor_spec * light.color);
     float distance = length((camController.position,1) - fragData.world_position);
     color =  (diffuse +  specular + em);
-    vec4 mixx = mix(color,vec4(.72,.89,1,1), distance/1000);
-    if (distance <= 150) {
+    vec4 mixx = mix(color,vec4(.72,.89,1,1), distance/FOG_DISTANCE);
+    if (distance <= FOG_CUTOFF) {
         color = mixx;
     }
     else
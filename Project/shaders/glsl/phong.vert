@@ -22,17 +22,24 @@ layout(set = 0, binding = 2) uniform System{
     float time;
 } system;
 
-layout(set = 1, binding = 4) uniform Translation{
+struct DrawData {
     mat4 transform;
-} translation;
+    uint material;
+};
+
+// One entry per draw, selected through the firstInstance of the draw call
+layout(set = 1, binding = 2) readonly buffer Draws{
+    DrawData data[];
+} draws;
 
 
 /*TODO: Shader Specific Data Here*/
+layout(constant_id = 0) const float MESH_SCALE = 0.05;
 // Vertex Shader Inputs
 layout(location = 0) in vec3 vertex_position;
 layout(location = 1) in vec2 vertex_textureCoordinates;
 layout(location = 2) in vec3 vertex_normal;
-layout(location = 3) in vec3 vertex_tangent;
+layout(location = 3) in vec2 vertex_tangent; // octahedral encoded
 
 
 
@@ -42,12 +49,22 @@ layout (location = 0) out FragData{
     vec3 normal;
     vec3 tangent;
 } fragData;
+layout(location = 4) flat out uint material;
+
+// https://knarkowicz.wordpress.com/2014/04/16/octahedron-normal-vector-encoding/
+vec3 octahedralDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0)));
+    return normalize(n);
+}
 
 void main() {
 
-    mat4 scale = mat4(0.05, 0, 0, 0,
-    0, 0.05, 0, 0,
-    0, 0, 0.05, 0,
+    mat4 scale = mat4(MESH_SCALE, 0, 0, 0,
+    0, MESH_SCALE, 0, 0,
+    0, 0, MESH_SCALE, 0,
     0, 0, 0, 1);
 
 //    mat4 translate = mat4(1, 0, 0, 0,
@@ -56,9 +73,11 @@ void main() {
 //    0, -0.8, -1.6, 1);
 
 
-    gl_Position = fragData.world_position = camera.projection * (((translation.transform * scale)) * vec4(vertex_position, 1));
+    DrawData draw = draws.data[gl_InstanceIndex];
+    gl_Position = fragData.world_position = camera.projection * (((draw.transform * scale)) * vec4(vertex_position, 1));
     fragData.uv = vertex_textureCoordinates;
     fragData.normal = vertex_normal;
-    fragData.tangent = vertex_tangent;
+    fragData.tangent = octahedralDecode(vertex_tangent);
+    material = draw.material;
 
 }
\ No newline at end of file
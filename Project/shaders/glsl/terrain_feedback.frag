@@ -0,0 +1,37 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_KHR_vulkan_glsl: enable
+
+// Writes the virtual texture page every pixel of the terrain wants, read back by tga::VirtualTexture::readFeedback
+
+// The feedback target is smaller than the window, which makes the derivatives larger by the same factor
+layout(constant_id = 0) const float LOD_BIAS = -3.0;
+
+layout(set = 1, binding = 3) uniform VirtualTexture{
+    uint size;
+    uint contentSize;
+    uint border;
+    uint levelCount;
+    uint cachePages;
+    uint pageSize;
+} vt;
+
+layout(location = 0) in FragData{
+    vec4 clipped_coordinates;
+    vec2 uv;
+    vec3 normal;
+} fragData;
+
+layout(location = 0) out uint page;
+
+void main()
+{
+    vec2 uv = clamp(fragData.uv, 0.0, 1.0 - 1.0 / float(vt.size));
+    vec2 texels = uv * float(vt.size);
+    vec2 dx = dFdx(texels), dy = dFdy(texels);
+    float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + LOD_BIAS;
+    uint level = uint(clamp(floor(lod), 0.0, float(vt.levelCount - 1)));
+    uvec2 xy = uvec2(uv * float(vt.size >> level)) / vt.contentSize;
+    // 0 is the clear value and means no page
+    page = ((level << 24) | (xy.y << 12) | xy.x) + 1;
+}
@@ -27,7 +27,21 @@ layout(set = 0, binding = 2) uniform System{
 /*TODO: Shader Specific Data Here*/
 
 
-layout(set = 1 , binding = 1) uniform sampler2D  MyTexture;
+// Virtual texture, see tga::VirtualTexture
+layout(set = 1 , binding = 1) uniform sampler2D pageCache;
+
+layout(set = 1, binding = 2) readonly buffer PageTable{
+    uint entries[];
+} pageTable;
+
+layout(set = 1, binding = 3) uniform VirtualTexture{
+    uint size;
+    uint contentSize;
+    uint border;
+    uint levelCount;
+    uint cachePages;
+    uint pageSize;
+} vt;
 
 
 layout(location = 0) in FragData{
@@ -43,9 +57,40 @@ layout(location = 0) out vec4 color;
 
 
 
+uint pageIndex(uint level, uvec2 page)
+{
+    uint pagesPerSide = vt.size / vt.contentSize;
+    uint offset = 0;
+    for (uint l = 0; l < level; ++l) offset += (pagesPerSide >> l) * (pagesPerSide >> l);
+    return offset + page.y * (pagesPerSide >> level) + page.x;
+}
+
+vec4 sampleVirtual(vec2 uv)
+{
+    uv = clamp(uv, 0.0, 1.0 - 1.0 / float(vt.size));
+    // Derivatives are taken before the lookup loop, which is non uniform control flow
+    vec2 texels = uv * float(vt.size);
+    vec2 dx = dFdx(texels), dy = dFdy(texels);
+    float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy)));
+    uint level = uint(clamp(floor(lod), 0.0, float(vt.levelCount - 1)));
+
+    // Missing pages fall back to the next coarser level, the coarsest one is always resident
+    for (; level < vt.levelCount; ++level) {
+        vec2 levelTexel = uv * float(vt.size >> level);
+        uvec2 page = uvec2(levelTexel) / vt.contentSize;
+        uint entry = pageTable.entries[pageIndex(level, page)];
+        if (entry == 0) continue;
+        uint slot = entry - 1;
+        vec2 slotOrigin = vec2(uvec2(slot % vt.cachePages, slot / vt.cachePages) * vt.pageSize + vt.border);
+        vec2 cacheTexel = slotOrigin + levelTexel - vec2(page * vt.contentSize);
+        return textureLod(pageCache, cacheTexel / float(vt.cachePages * vt.pageSize), 0.0);
+    }
+    return vec4(1, 0, 1, 1);
+}
+
 void main()
 {
-    vec4 firstData = texture(MyTexture, fragData.uv);
+    vec4 firstData = sampleVirtual(fragData.uv);
     vec3 changed = vec3(fragData.normal.x, fragData.normal.z, fragData.normal.y);
     color = (0.4 * dot(light.direction,changed) * firstData * light.color) + (0.4 * firstData * light.color);
     // color = (normalize(fragData.normal),1);
@@ -32,12 +32,25 @@ layout(set = 1 , binding = 0) uniform TerrainData {
 
 
 
-// Vertex Shader Inputs
-layout(location = 0) in vec3 vertex_position;
-layout(location = 1) in vec3 vertex_normal;
-layout(location = 2) in vec2 vertex_textureCoordinates;
-
-
+// Normalized heights, one texel per grid point of the finest level
+layout(set = 1, binding = 4) uniform sampler2D heights;
+
+// Octahedral normals of the heights, see generateNormalMap
+layout(set = 1, binding = 6) uniform sampler2D normals;
+
+// Framework TerrainNode, one per instance
+struct TerrainNode {
+    vec2 origin;  // First texel of the node
+    float step;   // Texels per grid cell
+    vec2 morph;
+};
+layout(set = 1, binding = 5) readonly buffer TerrainNodes {
+    TerrainNode nodes[];
+};
+
+// Cells per side of the grid of a node. There are no vertex inputs, vertex i of the grid sits at
+// (i % (GRID_CELLS + 1), i / (GRID_CELLS + 1))
+layout(constant_id = 0) const int GRID_CELLS = 32;
 
 //Vertex Shader output
 layout (location = 0) out FragData{
@@ -46,19 +59,43 @@ layout (location = 0) out FragData{
     vec3 normal;
 } fragData;
 
+float heightAt(vec2 texel)
+{
+    return textureLod(heights, (texel + 0.5) / vec2(textureSize(heights, 0)), 0).r;
+}
+
+// Inverse of the octahedral encoding, the lower half unfolds from the diagonals
+vec3 normalAt(vec2 texel)
+{
+    vec2 encoded = textureLod(normals, (texel + 0.5) / vec2(textureSize(normals, 0)), 0).rg;
+    vec3 normal = vec3(encoded, 1 - abs(encoded.x) - abs(encoded.y));
+    if (normal.z < 0) normal.xy = (1 - abs(normal.yx)) * sign(normal.xy);
+    return normalize(normal);
+}
+
+vec3 worldPosition(vec2 texel, float cells)
+{
+    vec2 uv = texel / cells;
+    return vec3(2 * uv.x - 1, heightAt(texel), 2 * uv.y - 1) * heightmap.dimensions;
+}
 
 void main()
 {
-    //https://www.saschawillems.de/blog/2016/08/13/vulkan-tutorial-on-rendering-a-fullscreen-quad-without-buffers/
-    //  fragData.uv = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
-    //  gl_Position = vec4(fragData.uv * 2.0f + -1.0f, 0.0f, 1.0f);
-  //  fragData.uv = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
-  //  gl_Position = vec4(fragData.uv * 2.0f + -1.0f, 0.0f, 1.0f);
-    fragData.clipped_coordinates =  camera.projection * camera.view *  (vec4(vertex_position * (heightmap.dimensions),1));
-    gl_Position = fragData.clipped_coordinates;
-    fragData.uv = vertex_textureCoordinates;
-    fragData.normal = vertex_normal;
+    TerrainNode node = nodes[gl_InstanceIndex];
+    vec2 grid_position = vec2(gl_VertexIndex % (GRID_CELLS + 1), gl_VertexIndex / (GRID_CELLS + 1));
+    float cells = float(textureSize(heights, 0).x - 1);
+    vec3 eye = camera.toWorld[3].xyz;
 
+    // Odd grid points slide onto the midpoint of their even neighbours, the grid of the next coarser level
+    float distanceToEye = distance(eye, worldPosition(node.origin + grid_position * node.step, cells));
+    float morph = clamp(node.morph.y * distanceToEye - node.morph.x, 0, 1);
+    vec2 gridPosition = grid_position - fract(grid_position * 0.5) * 2 * morph;
+    vec2 texel = node.origin + gridPosition * node.step;
 
+    // One fetch of the precomputed normal instead of four heights for central differences, z up
+    fragData.normal = normalAt(texel);
 
-}
\ No newline at end of file
+    fragData.clipped_coordinates = camera.projection * camera.view * vec4(worldPosition(texel, cells), 1);
+    gl_Position = fragData.clipped_coordinates;
+    fragData.uv = texel / cells;
+}
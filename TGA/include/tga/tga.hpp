@@ -16,6 +16,7 @@
 #include <string>
 #include <system_error>
 #include <tuple>
+#include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
 #include <variant>
@@ -161,10 +162,36 @@ namespace tga
         TgaCommandBuffer handle;
     };
 
+    /** \brief A QueryPool holds a fixed number of occlusion queries.
+     */
+    struct QueryPool {
+        QueryPool() : handle(TGA_NULL_HANDLE) {}
+        QueryPool(std::nullptr_t) : handle(TGA_NULL_HANDLE) {}
+        QueryPool(TgaQueryPool tgaQueryPool) : handle(tgaQueryPool) {}
+        QueryPool &operator=(TgaQueryPool tgaQueryPool)
+        {
+            handle = tgaQueryPool;
+            return *this;
+        }
+        operator TgaQueryPool() const { return handle; }
+        explicit operator bool() const { return handle != TGA_NULL_HANDLE; }
+        bool operator!() const { return handle == TGA_NULL_HANDLE; }
+
+    private:
+        TgaQueryPool handle;
+    };
+
     // enum classes
     enum class ShaderType { vertex, fragment, compute };
 
-    enum class BufferUsage : uint32_t { undefined = 0x0, uniform = 0x1, vertex = 0x2, index = 0x4, storage = 0x8 };
+    enum class BufferUsage : uint32_t {
+        undefined = 0x0,
+        uniform = 0x1,
+        vertex = 0x2,
+        index = 0x4,
+        storage = 0x8,
+        indirect = 0x10, /**<Holds DrawIndexedIndirectCommands*/
+    };
     inline BufferUsage operator|(BufferUsage a, BufferUsage b)
     {
         return static_cast<BufferUsage>(static_cast<uint32_t>(a) | static_cast<uint32_t>(b));
@@ -174,6 +201,18 @@ namespace tga
         return bool(static_cast<uint32_t>(a) & static_cast<uint32_t>(b));
     }
 
+    enum class IndexType { uint16, uint32 };
+
+    /** \brief Parameters of one draw of drawIndexedIndirect, same layout as VkDrawIndexedIndirectCommand
+     */
+    struct DrawIndexedIndirectCommand {
+        uint32_t indexCount;
+        uint32_t instanceCount;
+        uint32_t firstIndex;
+        int32_t vertexOffset;
+        uint32_t firstInstance;
+    };
+
     // _ is needed because enum types aren't allowed to start with a number
     enum class TextureType { _2D, _2DArray, _3D, _Cube };
 
@@ -182,8 +221,10 @@ namespace tga
     enum class AddressMode { clampBorder, clampEdge, repeat, repeatMirrow };
 
     enum class PresentMode {
-        immediate,
-        vsync,
+        immediate,   /**<No synchronization, tears*/
+        vsync,       /**<Waits for the vertical blank, always available*/
+        mailbox,     /**<Waits for the vertical blank, but newer frames replace queued ones instead of waiting*/
+        fifoRelaxed, /**<Like vsync, but late frames are shown right away and may tear*/
     };
 
     enum class Format {
@@ -208,6 +249,17 @@ namespace tga
         r8g8b8a8_srgb,
         r8g8b8a8_unorm,
         r8g8b8a8_snorm,
+        r16_unorm,
+        r16_snorm,
+        r16_sfloat,
+        r16g16_unorm,
+        r16g16_snorm,
+        r16g16_sfloat,
+        r16g16b16a16_unorm,
+        r16g16b16a16_snorm,
+        r16g16b16a16_sfloat,
+        a2b10g10r10_unorm_pack32,
+        a2b10g10r10_snorm_pack32,
         r32_uint,
         r32_sint,
         r32_sfloat,
@@ -269,20 +321,27 @@ namespace tga
         BlendFactor dstBlend;
         BlendFactor srcAlphaBlend;
         BlendFactor dstAlphaBlend;
+        bool writeEnabled; /**<Without writes neither color nor depth change, the pass only tests depth. For proxy
+                              geometry of occlusion queries*/
         PerPixelOperations(CompareOperation _depthCompareOp = CompareOperation::ignore, bool _blendEnabled = false,
                            BlendFactor _srcBlend = BlendFactor::srcAlpha,
                            BlendFactor _dstBlend = BlendFactor::oneMinusSrcAlpha,
                            BlendFactor _srcAlphaBlend = BlendFactor::one,
-                           BlendFactor _dstAlphaBlend = BlendFactor::oneMinusSrcAlpha)
+                           BlendFactor _dstAlphaBlend = BlendFactor::oneMinusSrcAlpha, bool _writeEnabled = true)
             : depthCompareOp(_depthCompareOp), blendEnabled(_blendEnabled), srcBlend(_srcBlend), dstBlend(_dstBlend),
-              srcAlphaBlend(_srcAlphaBlend), dstAlphaBlend(_dstAlphaBlend)
+              srcAlphaBlend(_srcAlphaBlend), dstAlphaBlend(_dstAlphaBlend), writeEnabled(_writeEnabled)
         {}
     };
 
     struct BindingLayout {
         BindingType type;
-        uint32_t count;
-        BindingLayout(BindingType _type, uint32_t _count = 1) : type(_type), count(_count) {}
+        uint32_t count; /**<Number of array elements of the binding*/
+        bool bindless;  /**<Array elements may stay unbound and can be updated while the InputSet is in use, see
+                           Interface::bindlessSupported. Without support it is a plain array, missing elements are
+                           filled with the first bound element and updates wait for the device to be idle*/
+        BindingLayout(BindingType _type, uint32_t _count = 1, bool _bindless = false)
+            : type(_type), count(_count), bindless(_bindless)
+        {}
     };
 
     struct SetLayout {
@@ -291,6 +350,37 @@ namespace tga
         SetLayout(std::initializer_list<BindingLayout> _bindingLayouts) : bindingLayouts(_bindingLayouts){};
     };
 
+    struct SpecializationConstant {
+        uint32_t id;     /**<The constant_id of the constant in the shader*/
+        uint32_t offset; /**<Byte offset of the value inside SpecializationInfo.data*/
+        size_t size;     /**<Size of the value in bytes*/
+    };
+
+    /** \brief Values for the specialization constants of one shader stage, they are folded into the pipeline
+     */
+    struct SpecializationInfo {
+        ShaderType stage; /**<The shader stage these constants belong to*/
+        std::vector<SpecializationConstant> constants;
+        std::vector<uint8_t> data; /**<Tightly packed values of all constants*/
+        SpecializationInfo(ShaderType _stage) : stage(_stage) {}
+
+        /** \brief Appends a value for the constant with the given constant_id, e.g. set(0, 150.f)
+         */
+        template <typename T>
+        SpecializationInfo &set(uint32_t id, T const &value)
+        {
+            static_assert(std::is_trivially_copyable_v<T>, "Specialization constants must be trivially copyable");
+            constants.push_back({id, uint32_t(data.size()), sizeof(T)});
+            auto bytes = reinterpret_cast<uint8_t const *>(&value);
+            data.insert(data.end(), bytes, bytes + sizeof(T));
+            return *this;
+        }
+
+        /** \brief Booleans are 32 bit in SPIR-V, the value is stored as a VkBool32 of 0 or 1
+         */
+        SpecializationInfo &set(uint32_t id, bool value) { return set(id, uint32_t(value ? 1 : 0)); }
+    };
+
     struct InputLayout {
         std::vector<SetLayout> setLayouts;
         InputLayout(const std::vector<SetLayout> &_setLayouts = {}) : setLayouts(_setLayouts) {}
@@ -345,29 +435,35 @@ namespace tga
         TextureType textureType; /**<Type of the texture, by default 2D*/
         uint32_t depthLayers; /**<If texture type is not 2D, this describes the third dimension of the image. Must be 6
                                  for Cube */
+        uint32_t mipLevels;   /**<Number of mip levels. The data holds all of them back to back, largest first. Every
+                                 level halves the dimensions of the previous one, rounded down but at least 1*/
         TextureInfo(uint32_t _width, uint32_t _height, Format _format, uint8_t const *_data, size_t _dataSize,
                     SamplerMode _samplerMode = SamplerMode::nearest,
                     AddressMode _repeateMode = AddressMode::clampBorder, TextureType _textureType = TextureType::_2D,
-                    uint32_t _depthLayers = 1)
+                    uint32_t _depthLayers = 1, uint32_t _mipLevels = 1)
             : width(_width), height(_height), format(_format), data(_data), dataSize(_dataSize),
-              samplerMode(_samplerMode), addressMode(_repeateMode), textureType(_textureType), depthLayers(_depthLayers)
+              samplerMode(_samplerMode), addressMode(_repeateMode), textureType(_textureType), depthLayers(_depthLayers),
+              mipLevels(_mipLevels)
         {}
 
         TextureInfo(uint32_t _width, uint32_t _height, Format _format,
                     std::vector<uint8_t> const &_data = std::vector<uint8_t>(),
                     SamplerMode _samplerMode = SamplerMode::nearest,
                     AddressMode _repeateMode = AddressMode::clampBorder, TextureType _textureType = TextureType::_2D,
-                    uint32_t _depthLayers = 1)
+                    uint32_t _depthLayers = 1, uint32_t _mipLevels = 1)
             : width(_width), height(_height), format(_format), data(_data.data()), dataSize(_data.size()),
-              samplerMode(_samplerMode), addressMode(_repeateMode), textureType(_textureType), depthLayers(_depthLayers)
+              samplerMode(_samplerMode), addressMode(_repeateMode), textureType(_textureType), depthLayers(_depthLayers),
+              mipLevels(_mipLevels)
         {}
     };
     struct WindowInfo {
         uint32_t width;            /**<Width of the Window in pixels*/
         uint32_t height;           /**<Height of the Window in pixels*/
         PresentMode presentMode;   /**<How syncronization to the monitor is handled. Valid PresentModes are
-                                      PresentMode::immediate (show frame as fast as possible, default) and
-                                      PresentMode::vsync (sync to the monitor refresh rate)*/
+                                      PresentMode::immediate (show frame as fast as possible, default),
+                                      PresentMode::vsync (sync to the monitor refresh rate), PresentMode::mailbox
+                                      and PresentMode::fifoRelaxed. If unsupported, immediate falls back to
+                                      mailbox and then to vsync, mailbox and fifoRelaxed fall back to vsync*/
         uint32_t framebufferCount; /**<How many backbuffers the window has to manage. Due to minimum and maximum
                                       contraints this value may not be the actual resulting number of backbuffers and
                                       needs to be polled later*/
@@ -400,20 +496,29 @@ namespace tga
         PerPixelOperations perPixelOperations; /**<Describes operations on each sample, i.e depth-buffer and blending*/
         InputLayout inputLayout;               /**<Describes how the Bindings are organized*/
         VertexLayout vertexLayout;             /**<Describes the format of the vertices in the vertex-buffer*/
+        std::vector<SpecializationInfo>
+            specializations; /**<Specialization constants per shader stage, at most one entry per stage. Constants
+                                without a value keep the default from the shader*/
         RenderPassInfo(std::vector<Shader> const &_shaderStages, std::variant<Texture, Window> _renderTarget,
                        ClearOperation _clearOperations = ClearOperation::none,
                        RasterizerConfig _rasterizerConfig = RasterizerConfig(),
                        PerPixelOperations _perPixelOperations = PerPixelOperations(),
-                       InputLayout _inputLayout = InputLayout(), VertexLayout _vertexLayout = VertexLayout())
+                       InputLayout _inputLayout = InputLayout(), VertexLayout _vertexLayout = VertexLayout(),
+                       std::vector<SpecializationInfo> const &_specializations = {})
             : shaderStages(_shaderStages), renderTarget(_renderTarget), clearOperations(_clearOperations),
               rasterizerConfig(_rasterizerConfig), perPixelOperations(_perPixelOperations), inputLayout(_inputLayout),
-              vertexLayout(_vertexLayout)
+              vertexLayout(_vertexLayout), specializations(_specializations)
         {}
     };
     struct CommandBufferInfo {
         CommandBufferInfo() {}
     };
 
+    struct QueryPoolInfo {
+        uint32_t queryCount; /**<Number of occlusion queries, addressed with 0 to queryCount - 1*/
+        QueryPoolInfo(uint32_t _queryCount) : queryCount(_queryCount) {}
+    };
+
     /** \brief The abstract Interface to a Graphics API
      *
      */
@@ -421,32 +526,115 @@ namespace tga
     public:
         // Resource Creation
         virtual ~Interface() = default;
+
+        /** \brief Creates a Shader, identical code of the same ShaderType shares one Shader
+         * \return A reference counted Shader, every call needs a matching free(Shader)
+         */
         virtual Shader createShader(const ShaderInfo &shaderInfo) = 0;
         virtual Buffer createBuffer(const BufferInfo &bufferInfo) = 0;
+        /** \brief Creates a Buffer whose content is written straight into the upload memory, without a CPU side copy
+         * \param bufferInfo Size and usage of the Buffer, data must be nullptr
+         * \param fill Called once before the upload with bufferInfo.dataSize writable bytes. The memory may be write
+         * combined, so it should be written sequentially and never read
+         */
+        virtual Buffer createBuffer(const BufferInfo &bufferInfo, std::function<void(uint8_t *data)> const &fill) = 0;
         virtual Texture createTexture(const TextureInfo &textureInfo) = 0;
         virtual Window createWindow(const WindowInfo &windowInfo) = 0;
         virtual InputSet createInputSet(const InputSetInfo &inputSetInfo) = 0;
         virtual RenderPass createRenderPass(const RenderPassInfo &renderPassInfo) = 0;
+        virtual QueryPool createQueryPool(const QueryPoolInfo &queryPoolInfo) = 0;
+
+        /** \brief Creates several RenderPasses at once, their pipelines are compiled in parallel
+         * \return One RenderPass per RenderPassInfo in the same order, all ready to use
+         */
+        virtual std::vector<RenderPass> createRenderPasses(const std::vector<RenderPassInfo> &renderPassInfos) = 0;
 
         // Commands
         virtual void beginCommandBuffer() = 0;
         virtual void beginCommandBuffer(CommandBuffer cmdBuffer) = 0;
         virtual void setRenderPass(RenderPass renderPass, uint32_t framebufferIndex) = 0;
-        virtual void bindVertexBuffer(Buffer buffer) = 0;
-        virtual void bindIndexBuffer(Buffer buffer) = 0;
+        virtual void bindVertexBuffer(Buffer buffer, size_t offset = 0) = 0;
+        virtual void bindIndexBuffer(Buffer buffer, IndexType indexType = IndexType::uint32, size_t offset = 0) = 0;
         virtual void bindInputSet(InputSet inputSet) = 0;
         virtual void draw(uint32_t vertexCount, uint32_t firstVertex, uint32_t instanceCount = 1,
                           uint32_t firstInstance = 0) = 0;
         virtual void drawIndexed(uint32_t indexCount, uint32_t firstIndex, uint32_t vertexOffset,
                                  uint32_t instanceCount = 1, uint32_t firstInstance = 0) = 0;
+        /** \brief Runs the compute RenderPass that is set. Everything recorded afterwards (dispatches, draws, index
+         * and vertex fetches, readbacks) sees the buffers written by it, so dependent dispatches can follow directly
+         */
         virtual void dispatch(uint32_t groupCountX, uint32_t groupCountY, uint32_t groupCountZ) = 0;
+
+        /** \brief Issues drawCount indexed draws whose parameters are read from a Buffer
+         * \param indirectBuffer Buffer with BufferUsage::indirect holding tightly packed DrawIndexedIndirectCommands
+         * \param offset Byte offset of the first command, multiple of 4
+         */
+        virtual void drawIndexedIndirect(Buffer indirectBuffer, uint32_t drawCount, size_t offset = 0) = 0;
+
+        /** \brief Copies texels from a Buffer into the first level and layer of a Texture, e.g. the output of a
+         * compute pass. Must not be recorded inside of a graphics RenderPass, draws recorded afterwards see the texels
+         * \param rowLength Texels per row in the Buffer, 0 if the rows are tightly packed
+         */
+        virtual void copyBufferToTexture(Buffer buffer, Texture texture, uint32_t rowLength = 0) = 0;
+
+        /** \brief Publishes the results of the previous submission to conditional rendering and resets all queries
+         *
+         * Must be recorded before the first setRenderPass of the CommandBuffer.
+         */
+        virtual void resetQueries(QueryPool queryPool) = 0;
+
+        /** \brief Counts the samples passing the depth test until endOcclusionQuery, within one RenderPass
+         */
+        virtual void beginOcclusionQuery(QueryPool queryPool, uint32_t query) = 0;
+        virtual void endOcclusionQuery(QueryPool queryPool, uint32_t query) = 0;
+
+        /** \brief Skips draws and dispatches until endConditionalRendering if the query had no samples in the
+         * previous submission
+         *
+         * Without conditionalRenderingSupported() the draws are dropped while recording, based on the latest
+         * occlusionResults, so CommandBuffers that are executed more than once keep that decision.
+         */
+        virtual void beginConditionalRendering(QueryPool queryPool, uint32_t query) = 0;
+        virtual void endConditionalRendering() = 0;
         virtual CommandBuffer endCommandBuffer() = 0;
         virtual void execute(CommandBuffer commandBuffer) = 0;
 
         virtual void updateBuffer(Buffer buffer, uint8_t const *data, size_t dataSize, uint32_t offset) = 0;
+
+        /** \brief Overwrites a rectangle of the first layer of a Texture
+         * \param data Tightly packed texels of the rectangle, row by row
+         */
+        virtual void updateTexture(Texture texture, uint8_t const *data, size_t dataSize, uint32_t offsetX,
+                                   uint32_t offsetY, uint32_t width, uint32_t height) = 0;
+        /** \brief Copies the content back to the CPU, waits for the work executed so far
+         */
         virtual std::vector<uint8_t> readback(Buffer buffer) = 0;
         virtual std::vector<uint8_t> readback(Texture texture) = 0;
 
+        /** \brief Rewrites Bindings of an existing InputSet, e.g. to add textures to a bindless array
+         */
+        virtual void updateInputSet(InputSet inputSet, std::vector<Binding> const &bindings) = 0;
+
+        /** \brief Whether bindless BindingLayouts are partially bound and update after bind (descriptor indexing)
+         *
+         * Implies that shaders may index sampler arrays with dynamically uniform values, e.g. a material ID. Without
+         * it sampler arrays must only be indexed with constant expressions.
+         */
+        virtual bool bindlessSupported() = 0;
+
+        /** \brief Whether DrawIndexedIndirectCommand::firstInstance may be non zero
+         */
+        virtual bool indirectFirstInstanceSupported() = 0;
+
+        /** \brief Latest available sample count of every query, never waits for the GPU
+         * \return One count per query, queries without a result yet count as visible
+         */
+        virtual std::vector<uint64_t> occlusionResults(QueryPool queryPool) = 0;
+
+        /** \brief Whether conditional rendering is evaluated on the GPU (VK_EXT_conditional_rendering)
+         */
+        virtual bool conditionalRenderingSupported() = 0;
+
         // Window functions
 
         /** \brief Number of framebuffers used by a window.
@@ -499,5 +687,6 @@ namespace tga
         virtual void free(InputSet inputSet) = 0;
         virtual void free(RenderPass renderPass) = 0;
         virtual void free(CommandBuffer commandBuffer) = 0;
+        virtual void free(QueryPool queryPool) = 0;
     };
 }  // namespace tga
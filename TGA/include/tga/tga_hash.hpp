@@ -53,5 +53,12 @@ namespace std
             return std::hash<uint64_t>()(reinterpret_cast<uint64_t>((TgaCommandBuffer)key));
         }
     };
+    template <>
+    struct hash<tga::QueryPool> {
+        std::size_t operator()(const tga::QueryPool &key) const
+        {
+            return std::hash<uint64_t>()(reinterpret_cast<uint64_t>((TgaQueryPool)key));
+        }
+    };
 
 }  // namespace std
\ No newline at end of file
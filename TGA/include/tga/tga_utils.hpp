@@ -1,4 +1,11 @@
 #pragma once
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
 #include "tga/tga.hpp"
 #include "tga/tga_math.hpp"
 
@@ -46,9 +53,53 @@ namespace tga
         operator Texture() { return texture; }
     };
 
-    struct Obj {
+    /** \brief Index data shared by all mesh representations. Exactly one of the two index buffers is in use
+     */
+    struct IndexedMesh {
+        std::vector<uint32_t> indexBuffer;   /**<Indices if indexType is IndexType::uint32, empty otherwise*/
+        std::vector<uint16_t> indexBuffer16; /**<Indices if indexType is IndexType::uint16, empty otherwise*/
+        tga::IndexType indexType = tga::IndexType::uint32;
+
+        /** \brief Number of indices, independent of the index type */
+        size_t indexCount() const;
+        /** \brief Index at position i, independent of the index type */
+        uint32_t index(size_t i) const;
+        /** \brief Pointer to the active index buffer, ready to be used for tga::BufferInfo */
+        uint8_t const* indexData() const;
+        /** \brief Size of the active index buffer in bytes */
+        size_t indexDataSize() const;
+    };
+
+    struct Obj : IndexedMesh {
         std::vector<tga::Vertex> vertexBuffer;
-        std::vector<uint32_t> indexBuffer;
+    };
+
+    /** \brief How PackedVertex::position is stored
+     */
+    enum class PositionEncoding {
+        unorm16, /**<Quantized to the bounds of the mesh, needs PackedObj::dequantization() in the model matrix*/
+        sfloat16 /**<Half floats in object space, no dequantization needed but less precise for large meshes*/
+    };
+
+    /** \brief Compact 20 byte vertex, the quantized counterpart of tga::Vertex (44 bytes)
+     */
+    struct PackedVertex {
+        uint16_t position[4]; /**<Format::r16g16b16a16_unorm or r16g16b16a16_sfloat, see PositionEncoding. w is unused*/
+        uint16_t uv[2];       /**<Format::r16g16_sfloat*/
+        uint32_t normal;      /**<Format::a2b10g10r10_snorm_pack32*/
+        int16_t tangent[2];   /**<Format::r16g16_snorm, octahedral encoded unit vector*/
+
+        static tga::VertexLayout layout(PositionEncoding positionEncoding = PositionEncoding::unorm16);
+    };
+
+    struct PackedObj : IndexedMesh {
+        std::vector<PackedVertex> vertexBuffer;
+        PositionEncoding positionEncoding;
+        glm::vec3 boundsMin;    /**<Position that maps to a quantized position of 0*/
+        glm::vec3 boundsExtent; /**<Size of the bounding box that maps to a quantized position of 1*/
+
+        /** \brief Transforms stored positions back to object space. Fold it into the model matrix */
+        glm::mat4 dequantization() const;
     };
 
     struct Image {
@@ -72,7 +123,78 @@ namespace tga
     Image loadImage(std::string const& filepath);
     HDRImage loadHDRImage(std::string const& filepath, bool doGammaCorrection = false);
 
-    Obj loadObj(std::string const& filepath);
+    /**
+     * @brief How buildMipChain reduces a level to the next one
+     */
+    enum class MipFilter {
+        box,    /**<Average over the footprint, odd dimensions use the exact three texel weights*/
+        kaiser, /**<Kaiser windowed sinc, keeps more detail than box at the cost of slight ringing*/
+        min,    /**<Minimum per component over the footprint, e.g. conservative lower height bounds*/
+        max     /**<Maximum per component over the footprint, e.g. conservative upper height bounds*/
+    };
+
+    /**
+     * @brief All mip levels of an image in one allocation
+     *
+     * Level i is max(width >> i, 1) by max(height >> i, 1) texels, row by row. data can be passed as is to
+     * tga::TextureInfo with mipLevels = levelCount().
+     */
+    template <typename T>
+    struct MipChain {
+        uint32_t width, height; /**<Dimensions of level 0*/
+        uint32_t components;
+        std::vector<T> data;
+        std::vector<size_t> offsets; /**<Start of every level in data, in elements*/
+
+        uint32_t levelCount() const { return uint32_t(offsets.size()); }
+        uint32_t levelWidth(uint32_t level) const { return std::max(width >> level, 1u); }
+        uint32_t levelHeight(uint32_t level) const { return std::max(height >> level, 1u); }
+        T const* level(uint32_t level) const { return data.data() + offsets[level]; }
+    };
+
+    /**
+     * @brief Builds the mip chain of an HDR image, rows of the large levels are filtered in parallel
+     *
+     * @param levels Number of levels including the image itself, 0 builds the full chain down to 1x1
+     */
+    MipChain<float> buildMipChain(HDRImage const& image, MipFilter filter = MipFilter::box, uint32_t levels = 0);
+
+    /**
+     * @brief Builds the mip chain of an 8 bit image
+     *
+     * Levels are filtered in float and only quantized at the end. With srgb the color components are averaged in
+     * linear space, alpha (the last component of 2 and 4 component images) always is linear.
+     */
+    MipChain<uint8_t> buildMipChain(Image const& image, MipFilter filter = MipFilter::box, bool srgb = false,
+                                    uint32_t levels = 0);
+
+    /**
+     * @brief Loads a Wavefront obj file
+     *
+     * @param allowShortIndices Emit 16 bit indices (Obj::indexBuffer16) if every index fits, 32 bit otherwise
+     */
+    Obj loadObj(std::string const& filepath, bool allowShortIndices = true);
+
+    /**
+     * @brief Quantizes an Obj into the compact PackedVertex layout, indices are taken over as they are
+     */
+    PackedObj packObj(Obj const& obj, PositionEncoding positionEncoding = PositionEncoding::unorm16);
+
+    /**
+     * @brief Octahedral encoding of a unit vector into two components in [-1,1]
+     */
+    glm::vec2 octahedralEncode(glm::vec3 n);
+    glm::vec3 octahedralDecode(glm::vec2 e);
+
+    /**
+     * @brief The smallest index type that can address vertexCount vertices
+     */
+    tga::IndexType indexTypeFor(size_t vertexCount);
+
+    /**
+     * @brief Size of a single index in bytes
+     */
+    size_t indexSize(tga::IndexType indexType);
 
     void writeHDR(std::string const& filename, uint32_t width, uint32_t height, tga::Format format,
                   std::vector<float> const& data);
@@ -97,6 +219,265 @@ namespace tga
         return (uint8_t*)vector.data();
     }
 
+    /**
+     * @brief Loads every asset once and shares it between all users
+     *
+     * Assets are keyed by their path and the parameters they were loaded with. The cache only holds weak references,
+     * a texture or shader is freed as soon as the last returned pointer is released and loaded again on the next
+     * request. Requests for an asset that is still being loaded wait for that load instead of starting a second one.
+     * obj() can be called from any thread, texture() and shader() create GPU objects and follow the threading rules
+     * of the Interface.
+     */
+    class AssetCache {
+    public:
+        explicit AssetCache(std::shared_ptr<tga::Interface> const& tgai);
+
+        std::shared_ptr<TextureBundle const> texture(std::string const& filepath, tga::Format format,
+                                                     tga::SamplerMode samplerMode, bool doGammaCorrection = false);
+        std::shared_ptr<tga::Shader const> shader(std::string const& filepath, tga::ShaderType shaderType);
+        std::shared_ptr<Obj const> obj(std::string const& filepath, bool allowShortIndices = true);
+
+    private:
+        using Asset = std::shared_ptr<void const>;
+        struct Entry {
+            std::weak_ptr<void const> asset;
+            std::shared_future<Asset> loading; /**<Valid while the asset is being loaded*/
+        };
+
+        Asset acquire(std::string const& key, std::function<Asset()> const& load);
+
+        std::weak_ptr<tga::Interface> tgai; /**<Weak, assets released after the Interface have nothing left to free*/
+        std::mutex mutex;
+        std::unordered_map<std::string, Entry> entries;
+    };
+
+    /** \brief Location of a mesh inside a MeshArena, matches the parameters of Interface::drawIndexed
+     */
+    struct MeshRange {
+        uint32_t indexCount;
+        uint32_t firstIndex;
+        uint32_t vertexOffset; /**<Base vertex, added to every index of the mesh*/
+        uint32_t vertexCount;
+    };
+
+    /** \brief Packs many meshes into one vertex and one index buffer, so they can be drawn without rebinding buffers
+     *
+     * Indices stay relative to their mesh and are offset by MeshRange::vertexOffset when drawing. Thus 16 bit indices
+     * are used as long as every single mesh fits, no matter how large the arena grows.
+     */
+    template <typename VertexType>
+    class MeshArena {
+    public:
+        /**
+         * @brief Appends a mesh (e.g. tga::Obj or tga::PackedObj), only valid before upload()
+         *
+         * @return Where the mesh ended up, pass it on to drawIndexed
+         */
+        template <typename Mesh>
+        MeshRange add(Mesh const& mesh)
+        {
+            MeshRange range{static_cast<uint32_t>(mesh.indexCount()), static_cast<uint32_t>(indices.size()),
+                            static_cast<uint32_t>(vertices.size()), static_cast<uint32_t>(mesh.vertexBuffer.size())};
+            vertices.insert(vertices.end(), mesh.vertexBuffer.begin(), mesh.vertexBuffer.end());
+            indices.reserve(indices.size() + mesh.indexCount());
+            for (size_t i = 0; i < mesh.indexCount(); i++) indices.emplace_back(mesh.index(i));
+            if (indexTypeFor(mesh.vertexBuffer.size()) == IndexType::uint32) indexType = IndexType::uint32;
+            return range;
+        }
+
+        /**
+         * @brief Creates the GPU buffers and releases the CPU side copies
+         */
+        void upload(std::shared_ptr<tga::Interface> const& tgai)
+        {
+            vertexBuffer = tgai->createBuffer(
+                {BufferUsage::vertex, memoryAccess(vertices), vertices.size() * sizeof(VertexType)});
+            if (indexType == IndexType::uint16) {
+                std::vector<uint16_t> shortIndices(indices.begin(), indices.end());
+                indexBuffer = tgai->createBuffer(
+                    {BufferUsage::index, memoryAccess(shortIndices), shortIndices.size() * sizeof(uint16_t)});
+            } else {
+                indexBuffer =
+                    tgai->createBuffer({BufferUsage::index, memoryAccess(indices), indices.size() * sizeof(uint32_t)});
+            }
+            vertices = {};
+            indices = {};
+        }
+
+        /**
+         * @brief Binds both buffers, afterwards every mesh of the arena can be drawn with its MeshRange
+         */
+        void bind(std::shared_ptr<tga::Interface> const& tgai) const
+        {
+            tgai->bindVertexBuffer(vertexBuffer);
+            tgai->bindIndexBuffer(indexBuffer, indexType);
+        }
+
+        void free(std::shared_ptr<tga::Interface> const& tgai)
+        {
+            if (vertexBuffer) tgai->free(vertexBuffer);
+            if (indexBuffer) tgai->free(indexBuffer);
+            vertexBuffer = indexBuffer = tga::Buffer();
+        }
+
+        tga::Buffer vertexBuffer;
+        tga::Buffer indexBuffer;
+        tga::IndexType indexType = tga::IndexType::uint16;
+
+    private:
+        std::vector<VertexType> vertices;
+        std::vector<uint32_t> indices;
+    };
+
+    /** \brief Static list of MeshArena draws that goes out with a single drawIndexedIndirect
+     *
+     * Instances are numbered across the whole batch, so the shaders find the per draw data (transform, material) of
+     * an instance at gl_InstanceIndex in a storage buffer that lists the draws in the order they were added.
+     */
+    class DrawBatch {
+    public:
+        /**
+         * @brief Appends a draw, only valid before upload()
+         *
+         * @return Index of the first instance of the draw in the per draw data
+         */
+        uint32_t add(MeshRange const& range, uint32_t instanceCount = 1);
+
+        /**
+         * @brief Appends a draw whose per draw data is already placed at firstInstance, e.g. by a scene graph
+         */
+        void add(MeshRange const& range, uint32_t instanceCount, uint32_t firstInstance);
+
+        /**
+         * @brief Creates the indirect buffer
+         */
+        void upload(std::shared_ptr<tga::Interface> const& tgai);
+
+        /**
+         * @brief Draws the whole batch, the arena buffers and the input sets have to be bound already
+         */
+        void draw(std::shared_ptr<tga::Interface> const& tgai) const;
+
+        void free(std::shared_ptr<tga::Interface> const& tgai);
+
+        uint32_t instanceCount() const { return instances; }
+
+        tga::Buffer indirectBuffer;
+
+    private:
+        std::vector<DrawIndexedIndirectCommand> commands;
+        uint32_t instances = 0;
+        bool indirect = true;
+    };
+
+    struct VirtualTextureInfo {
+        uint32_t size;            /**<Texels per side of the finest level, power of two*/
+        uint32_t contentSize;     /**<Texels per side of a page without its border, power of two*/
+        uint32_t border;          /**<Texels repeated from the neighbour pages on every side, for filtering*/
+        uint32_t cachePages;      /**<Pages per side of the physical cache, the VRAM budget is
+                                     (cachePages * (contentSize + 2 * border))^2 * 4 bytes*/
+        uint32_t uploadsPerFrame; /**<Maximum number of pages moved into the cache by one update()*/
+        uint32_t feedbackScale;   /**<The feedback pass renders at 1/feedbackScale of the window resolution*/
+        VirtualTextureInfo(uint32_t _size = 16384, uint32_t _contentSize = 128, uint32_t _border = 1,
+                           uint32_t _cachePages = 24, uint32_t _uploadsPerFrame = 8, uint32_t _feedbackScale = 8)
+            : size(_size), contentSize(_contentSize), border(_border), cachePages(_cachePages),
+              uploadsPerFrame(_uploadsPerFrame), feedbackScale(_feedbackScale)
+        {}
+    };
+
+    /** \brief A page of a VirtualTexture, level 0 is the finest
+     */
+    struct VirtualPage {
+        uint32_t level, x, y;
+    };
+
+    /** \brief Streams a huge texture through a fixed size page cache
+     *
+     * Shaders translate virtual coordinates with the page table (one uint per page of every level, 0 if the page is
+     * not resident, slot + 1 otherwise) and sample the cache. Missing pages fall back to coarser levels, the single
+     * page of the coarsest level is always resident. A feedback pass writes the wanted page of every pixel into the
+     * feedback texture as (level << 24 | y << 12 | x) + 1, readFeedback() turns that into requests for the
+     * background loader and update() moves loaded pages into the cache, evicting the least recently used ones.
+     */
+    class VirtualTexture {
+    public:
+        /** \brief Fills the texels of a page including its border as tightly packed rgba8
+         *
+         * The page covers the texels [x * contentSize - border, (x + 1) * contentSize + border) of the level, the
+         * same for y. Runs on the loader thread.
+         */
+        using PageLoader = std::function<void(VirtualPage page, std::vector<uint8_t>& rgba)>;
+
+        /** \brief Uniform buffer contents, matches the VirtualTexture block of the shaders
+         */
+        struct Parameters {
+            alignas(4) uint32_t size;
+            alignas(4) uint32_t contentSize;
+            alignas(4) uint32_t border;
+            alignas(4) uint32_t levelCount;
+            alignas(4) uint32_t cachePages;
+            alignas(4) uint32_t pageSize;
+        };
+
+        VirtualTexture(std::shared_ptr<tga::Interface> const& tgai, VirtualTextureInfo const& info,
+                       uint32_t windowWidth, uint32_t windowHeight, PageLoader loader);
+        ~VirtualTexture();
+        VirtualTexture(VirtualTexture const&) = delete;
+        VirtualTexture& operator=(VirtualTexture const&) = delete;
+
+        /**
+         * @brief Reads the feedback texture back and requests the missing pages, the coarsest first
+         */
+        void readFeedback();
+
+        /**
+         * @brief Moves loaded pages into the cache and updates the page table
+         */
+        void update();
+
+        uint32_t levelCount() const { return parameters.levelCount; }
+
+        tga::Texture cache;           /**<rgba8 physical page cache*/
+        tga::Buffer pageTable;        /**<Storage buffer, see class description*/
+        tga::Buffer parameterBuffer;  /**<Uniform buffer holding the Parameters*/
+        tga::Texture feedback;        /**<r32_uint render target of the feedback pass*/
+        uint32_t feedbackWidth, feedbackHeight;
+
+    private:
+        struct Slot {
+            uint32_t key;
+            uint64_t lastUsed;
+            bool occupied;
+        };
+        struct LoadedPage {
+            uint32_t key;
+            std::vector<uint8_t> texels;
+        };
+
+        uint32_t pageIndex(uint32_t key) const;
+        void upload(uint32_t key, std::vector<uint8_t> const& texels, uint32_t slot);
+        void loaderLoop();
+
+        std::shared_ptr<tga::Interface> tgai;
+        Parameters parameters;
+        uint32_t uploadsPerFrame;
+        PageLoader loader;
+        std::vector<uint32_t> levelOffsets;
+        std::vector<uint32_t> pageTableData;
+        std::vector<Slot> slots;
+        std::unordered_map<uint32_t, uint32_t> residentSlots;
+        uint64_t frame = 0;
+
+        // Shared with the loader thread
+        std::mutex mutex;
+        std::condition_variable wakeLoader;
+        std::vector<uint32_t> requests; /**<Sorted so that the coarsest page is at the back*/
+        std::unordered_set<uint32_t> pending;
+        std::vector<LoadedPage> loaded;
+        bool stopLoader = false;
+        std::thread loaderThread;
+    };
+
 }  // namespace tga
 
 namespace std
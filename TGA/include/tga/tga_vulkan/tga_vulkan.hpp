@@ -15,27 +15,74 @@ namespace tga
 
         Shader createShader(const ShaderInfo &shaderInfo) override;
         Buffer createBuffer(const BufferInfo &bufferInfo) override;
+        Buffer createBuffer(const BufferInfo &bufferInfo, std::function<void(uint8_t *data)> const &fill) override;
         Texture createTexture(const TextureInfo &textureInfo) override;
         Window createWindow(const WindowInfo &windowInfo) override;
         InputSet createInputSet(const InputSetInfo &inputSetInfo) override;
         RenderPass createRenderPass(const RenderPassInfo &renderPassInfo) override;
+        QueryPool createQueryPool(const QueryPoolInfo &queryPoolInfo) override;
+
+        /** \copydoc Interface::createRenderPasses(const std::vector<RenderPassInfo> &renderPassInfos)
+        */
+        std::vector<RenderPass> createRenderPasses(const std::vector<RenderPassInfo> &renderPassInfos) override;
 
         void beginCommandBuffer() override;
         void beginCommandBuffer(CommandBuffer cmdBuffer) override;
         void setRenderPass(RenderPass renderPass, uint32_t frambufferIndex) override;
-        void bindVertexBuffer(Buffer buffer) override;
-        void bindIndexBuffer(Buffer buffer) override;
+        void bindVertexBuffer(Buffer buffer, size_t offset = 0) override;
+        void bindIndexBuffer(Buffer buffer, IndexType indexType = IndexType::uint32, size_t offset = 0) override;
         void bindInputSet(InputSet inputSet) override;
         void draw(uint32_t vertexCount, uint32_t firstVertex, uint32_t instanceCount = 1, uint32_t firstInstance = 0) override;
         void drawIndexed(uint32_t indexCount, uint32_t firstIndex, uint32_t vertexOffset, uint32_t instanceCount = 1, uint32_t firstInstance = 0) override;
         void dispatch(uint32_t groupCountX, uint32_t groupCountY, uint32_t groupCountZ) override;
+
+        /** \copydoc Interface::drawIndexedIndirect(Buffer indirectBuffer, uint32_t drawCount, size_t offset)
+        */
+        void drawIndexedIndirect(Buffer indirectBuffer, uint32_t drawCount, size_t offset = 0) override;
+
+        /** \copydoc Interface::copyBufferToTexture(Buffer buffer, Texture texture, uint32_t rowLength)
+        */
+        void copyBufferToTexture(Buffer buffer, Texture texture, uint32_t rowLength = 0) override;
+
+        /** \copydoc Interface::resetQueries(QueryPool queryPool)
+        */
+        void resetQueries(QueryPool queryPool) override;
+        void beginOcclusionQuery(QueryPool queryPool, uint32_t query) override;
+        void endOcclusionQuery(QueryPool queryPool, uint32_t query) override;
+
+        /** \copydoc Interface::beginConditionalRendering(QueryPool queryPool, uint32_t query)
+        */
+        void beginConditionalRendering(QueryPool queryPool, uint32_t query) override;
+        void endConditionalRendering() override;
         CommandBuffer endCommandBuffer() override;
         void execute(CommandBuffer commandBuffer) override;
 
         void updateBuffer(Buffer buffer, uint8_t const *data, size_t dataSize, uint32_t offset) override;
+        void updateTexture(Texture texture, uint8_t const *data, size_t dataSize, uint32_t offsetX, uint32_t offsetY,
+                           uint32_t width, uint32_t height) override;
         std::vector<uint8_t> readback(Buffer buffer) override;
         std::vector<uint8_t> readback(Texture texture) override;
 
+        /** \copydoc Interface::updateInputSet(InputSet inputSet, std::vector<Binding> const &bindings)
+        */
+        void updateInputSet(InputSet inputSet, std::vector<Binding> const &bindings) override;
+
+        /** \copydoc Interface::bindlessSupported()
+        */
+        bool bindlessSupported() override;
+
+        /** \copydoc Interface::indirectFirstInstanceSupported()
+        */
+        bool indirectFirstInstanceSupported() override;
+
+        /** \copydoc Interface::occlusionResults(QueryPool queryPool)
+        */
+        std::vector<uint64_t> occlusionResults(QueryPool queryPool) override;
+
+        /** \copydoc Interface::conditionalRenderingSupported()
+        */
+        bool conditionalRenderingSupported() override;
+
         /** \copydoc Interface::backbufferCount(Window window)
         */
         uint32_t backbufferCount(Window window) override;
@@ -79,6 +126,7 @@ namespace tga
         void free(InputSet inputSet) override;
         void free(RenderPass renderPass) override;
         void free(CommandBuffer commandBuffer) override;
+        void free(QueryPool queryPool) override;
 
     private:
         //Vulkan Stuff
@@ -87,16 +135,23 @@ namespace tga
         vk::DebugUtilsMessengerEXT debugger;
         vk::PhysicalDevice pDevice;
         QueueIndices queueIndices;
+        bool descriptorIndexing;
+        bool conditionalRendering;
+        vk::PhysicalDeviceFeatures features;
         vk::Device device;
         vk::Queue graphicsQueue;
         vk::Queue transferQueue;
         vk::CommandPool transferCmdPool;
         vk::CommandPool graphicsCmdPool;
+        PFN_vkCmdBeginConditionalRenderingEXT pfnCmdBeginConditionalRendering = nullptr;
+        PFN_vkCmdEndConditionalRenderingEXT pfnCmdEndConditionalRendering = nullptr;
 
         const std::vector<const char *> getInstanceExtentensions();
         const std::vector<const char *> getDeviceExtentensions();
         const std::vector<const char *> getLayers();
         vk::PhysicalDeviceFeatures getDeviceFeatures();
+        bool findDescriptorIndexingSupport();
+        bool findConditionalRenderingSupport();
         uint32_t findQueueFamily(vk::QueueFlags mask, vk::QueueFlags flags);
         QueueIndices findQueueFamilies();
 
@@ -113,22 +168,31 @@ namespace tga
         vk::Format findDepthFormat();
         DepthBuffer_TV createDepthBuffer(uint32_t width, uint32_t height);
         vk::RenderPass makeRenderPass(vk::Format colorFormat, ClearOperation clearOps, vk::ImageLayout layout);
+        RenderPass_TV prepareRenderPass(const RenderPassInfo &renderPassInfo);
+        void destroyRenderPass(RenderPass_TV &renderPass);
         std::vector<vk::DescriptorSetLayout> decodeInputLayout(const InputLayout &inputLayout);
+        void writeBindings(InputSet_TV &inputSet, std::vector<Binding> const &bindings);
         vk::Pipeline makeGraphicsPipeline(const RenderPassInfo &renderPassInfo, vk::PipelineLayout pipelineLayout, vk::RenderPass renderPass);
         std::pair<vk::Pipeline, vk::PipelineBindPoint> makePipeline(const RenderPassInfo &renderPassInfo, vk::PipelineLayout pipelineLayout, vk::RenderPass renderPass);
 
         vk::CommandBuffer beginOneTimeCmdBuffer(vk::CommandPool &cmdPool);
         void endOneTimeCmdBuffer(vk::CommandBuffer &cmdBuffer, vk::CommandPool &cmdPool, vk::Queue &submitQueue);
 
+        void updateOcclusionResults(QueryPool_TV &queryPool);
         void fillBuffer(size_t size, const uint8_t *data, uint32_t offset, vk::Buffer target);
         void transitionImageLayout(vk::CommandBuffer cmdBuffer, vk::Image image, vk::ImageLayout oldLayout, vk::ImageLayout newLayout);
-        void fillTexture(size_t size, const uint8_t *data, vk::Extent3D extent, uint32_t layers, vk::Image target);
+        void fillTexture(size_t size, const uint8_t *data, vk::Extent3D extent, uint32_t layers, vk::Image target,
+                         vk::Offset3D offset = {}, uint32_t mipLevels = 1);
 
         //Convertes
         vk::BufferUsageFlags determineBufferFlags(tga::BufferUsage usage);
         vk::Format determineImageFormat(tga::Format format);
+        vk::IndexType determineIndexType(tga::IndexType indexType);
         std::tuple<vk::Filter, vk::SamplerAddressMode> determineSamplerInfo(const TextureInfo &textureInfo);
         vk::ShaderStageFlagBits determineShaderStage(tga::ShaderType shaderType);
+        vk::SpecializationInfo const *determineSpecializationInfo(const RenderPassInfo &renderPassInfo, ShaderType stage,
+                                                                  std::vector<vk::SpecializationMapEntry> &mapEntries,
+                                                                  vk::SpecializationInfo &specializationInfo);
         std::vector<vk::VertexInputAttributeDescription> determineVertexAttributes(const std::vector<VertexAttribute> &attributes);
         vk::PipelineRasterizationStateCreateInfo determineRasterizerState(const RasterizerConfig &config);
         vk::CompareOp determineDepthCompareOp(CompareOperation compareOperation);
@@ -141,17 +205,21 @@ namespace tga
 
         //Bookkeeping
         std::unordered_map<Shader, Shader_TV> shaders;
+        std::unordered_multimap<size_t, Shader> shaderCache;
         std::unordered_map<Buffer, Buffer_TV> buffers;
         std::unordered_map<Texture, Texture_TV> textures;
         std::unordered_map<InputSet, InputSet_TV> inputSets;
         std::unordered_map<RenderPass, RenderPass_TV> renderPasses;
         std::unordered_map<CommandBuffer, CommandBuffer_TV> commandBuffers;
+        std::unordered_map<QueryPool, QueryPool_TV> queryPools;
         std::unordered_map<Texture, DepthBuffer_TV> textureDepthBuffers;
         std::unordered_map<Window, DepthBuffer_TV> windowDepthBuffers;
 
         struct RecordingData {
             vk::CommandBuffer cmdBuffer;
             RenderPass renderPass;
+            bool conditional = false;
+            bool skipDraws = false;  // Conditional rendering on the CPU
         } currentRecording;
     };
 }  // namespace tga
\ No newline at end of file
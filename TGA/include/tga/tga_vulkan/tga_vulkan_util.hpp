@@ -11,6 +11,9 @@ namespace tga
     struct Shader_TV {
         vk::ShaderModule module;
         tga::ShaderType type;
+        size_t codeHash;
+        std::vector<uint8_t> code;  // Compared on cache hits, different code may share a hash
+        uint32_t refCount;
     };
     struct Buffer_TV {
         vk::Buffer buffer;
@@ -38,12 +41,14 @@ namespace tga
         vk::DescriptorPool descriptorPool;
         vk::DescriptorSet descriptorSet;
         uint32_t index;
+        SetLayout layout;
     };
 
     struct RenderPass_TV {
         std::vector<vk::Framebuffer> framebuffers;
         vk::RenderPass renderPass;
         std::vector<vk::DescriptorSetLayout> setLayouts;
+        InputLayout inputLayout;
         vk::PipelineLayout pipelineLayout;
         vk::Pipeline pipeline;
         vk::PipelineBindPoint bindPoint;
@@ -54,4 +59,11 @@ namespace tga
         vk::CommandBuffer cmdBuffer;
     };
 
+    struct QueryPool_TV {
+        vk::QueryPool queryPool;
+        uint32_t queryCount;
+        std::vector<uint64_t> samples;
+        Buffer_TV predicates;  // One uint32 per query, only with conditional rendering
+    };
+
 }  // namespace tga
\ No newline at end of file
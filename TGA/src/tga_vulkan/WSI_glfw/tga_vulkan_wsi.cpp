@@ -203,17 +203,24 @@ namespace tga
     vk::PresentModeKHR VulkanWSI::choosePresentMode(vk::SurfaceKHR surface, PresentMode wantedPresentMode)
     {
         auto presentModes = pDevice.getSurfacePresentModesKHR(surface);
-        auto presentMode = vk::PresentModeKHR::eFifo;  // Always available
-        if (wantedPresentMode == PresentMode::immediate) {
-            for (const auto &mode : presentModes) {
-                if (mode == vk::PresentModeKHR::eMailbox) {
-                    return mode;  // Prefer Mailbox over Immediate
-                } else if (mode == vk::PresentModeKHR::eImmediate) {
-                    presentMode = mode;
-                }
-            }
+        auto supported = [&](vk::PresentModeKHR mode) {
+            return std::find(presentModes.begin(), presentModes.end(), mode) != presentModes.end();
+        };
+        switch (wantedPresentMode) {
+            case PresentMode::immediate:
+                if (supported(vk::PresentModeKHR::eImmediate)) return vk::PresentModeKHR::eImmediate;
+                // Mailbox doesn't tear, but at least doesn't wait for the monitor either
+                if (supported(vk::PresentModeKHR::eMailbox)) return vk::PresentModeKHR::eMailbox;
+                break;
+            case PresentMode::mailbox:
+                if (supported(vk::PresentModeKHR::eMailbox)) return vk::PresentModeKHR::eMailbox;
+                break;
+            case PresentMode::fifoRelaxed:
+                if (supported(vk::PresentModeKHR::eFifoRelaxed)) return vk::PresentModeKHR::eFifoRelaxed;
+                break;
+            case PresentMode::vsync: break;
         }
-        return presentMode;
+        return vk::PresentModeKHR::eFifo;  // Always available
     }
     vk::Extent2D VulkanWSI::chooseSwapExtent(vk::SurfaceKHR surface, const WindowInfo &windowInfo)
     {
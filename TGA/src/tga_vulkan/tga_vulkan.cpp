@@ -1,18 +1,30 @@
 #include "tga/tga_vulkan/tga_vulkan.hpp"
 
+#include <future>
+#include <string_view>
+
 #include "tga/tga_vulkan/tga_vulkan_debug.hpp"
 
 namespace tga
 {
     TGAVulkan::TGAVulkan()
         : wsi(VulkanWSI()), instance(createInstance()), debugger(createDebugger()), pDevice(choseGPU()),
-          queueIndices(findQueueFamilies()), device(createDevice()),
+          queueIndices(findQueueFamilies()), descriptorIndexing(findDescriptorIndexingSupport()),
+          conditionalRendering(findConditionalRenderingSupport()), features(getDeviceFeatures()),
+          device(createDevice()),
           graphicsQueue(device.getQueue(queueIndices.graphics, 0)),
           transferQueue(device.getQueue(queueIndices.transfer, 0)),
           transferCmdPool(createCommandPool(queueIndices.transfer)),
           graphicsCmdPool(createCommandPool(queueIndices.graphics, vk::CommandPoolCreateFlagBits::eResetCommandBuffer))
     {
         wsi.setVulkanHandles(instance, pDevice, device, graphicsQueue, queueIndices.graphics);
+        if (conditionalRendering) {
+            pfnCmdBeginConditionalRendering = reinterpret_cast<PFN_vkCmdBeginConditionalRenderingEXT>(
+                device.getProcAddr("vkCmdBeginConditionalRenderingEXT"));
+            pfnCmdEndConditionalRendering = reinterpret_cast<PFN_vkCmdEndConditionalRenderingEXT>(
+                device.getProcAddr("vkCmdEndConditionalRenderingEXT"));
+            conditionalRendering = pfnCmdBeginConditionalRendering && pfnCmdEndConditionalRendering;
+        }
         std::cout << "TGA Vulkan Created\n";
     }
 
@@ -46,6 +58,33 @@ namespace tga
         }
         return VK_QUEUE_FAMILY_IGNORED;
     }
+    bool TGAVulkan::findDescriptorIndexingSupport()
+    {
+        bool extensionFound = false;
+        for (auto &extension : pDevice.enumerateDeviceExtensionProperties())
+            if (std::strcmp(extension.extensionName, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) == 0)
+                extensionFound = true;
+        if (!extensionFound) return false;
+        // Bindless arrays are indexed with per draw values, so the core feature is needed as well
+        if (!pDevice.getFeatures().shaderSampledImageArrayDynamicIndexing) return false;
+        auto features =
+            pDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceDescriptorIndexingFeaturesEXT>();
+        auto &indexing = features.get<vk::PhysicalDeviceDescriptorIndexingFeaturesEXT>();
+        return indexing.descriptorBindingPartiallyBound && indexing.descriptorBindingSampledImageUpdateAfterBind &&
+               indexing.descriptorBindingStorageBufferUpdateAfterBind &&
+               indexing.descriptorBindingUpdateUnusedWhilePending;
+    }
+    bool TGAVulkan::findConditionalRenderingSupport()
+    {
+        bool extensionFound = false;
+        for (auto &extension : pDevice.enumerateDeviceExtensionProperties())
+            if (std::strcmp(extension.extensionName, VK_EXT_CONDITIONAL_RENDERING_EXTENSION_NAME) == 0)
+                extensionFound = true;
+        if (!extensionFound) return false;
+        auto features =
+            pDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceConditionalRenderingFeaturesEXT>();
+        return features.get<vk::PhysicalDeviceConditionalRenderingFeaturesEXT>().conditionalRendering;
+    }
     QueueIndices TGAVulkan::findQueueFamilies()
     {
         uint32_t graphicsQueue = findQueueFamily(vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute,
@@ -60,7 +99,6 @@ namespace tga
     {
         auto layers = getLayers();
         auto extensions = getDeviceExtentensions();
-        auto features = getDeviceFeatures();
         float queuePriority = 1.0f;
         std::vector<vk::DeviceQueueCreateInfo> queueInfos;
         std::unordered_set<uint32_t> queueFamiliySet;
@@ -69,14 +107,32 @@ namespace tga
         for (auto family : queueFamiliySet) {
             queueInfos.push_back(vk::DeviceQueueCreateInfo({}, family, 1, &queuePriority));
         }
-        return pDevice.createDevice({{},
-                                     uint32_t(queueInfos.size()),
-                                     queueInfos.data(),
-                                     uint32_t(layers.size()),
-                                     layers.data(),
-                                     uint32_t(extensions.size()),
-                                     extensions.data(),
-                                     &features});
+        vk::DeviceCreateInfo deviceInfo{{},
+                                        uint32_t(queueInfos.size()),
+                                        queueInfos.data(),
+                                        uint32_t(layers.size()),
+                                        layers.data(),
+                                        uint32_t(extensions.size()),
+                                        extensions.data(),
+                                        &features};
+        void *featureChain = nullptr;
+        vk::PhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures{};
+        if (descriptorIndexing) {
+            indexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+            indexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+            indexingFeatures.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+            indexingFeatures.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+            indexingFeatures.setPNext(featureChain);
+            featureChain = &indexingFeatures;
+        }
+        vk::PhysicalDeviceConditionalRenderingFeaturesEXT conditionalRenderingFeatures{};
+        if (conditionalRendering) {
+            conditionalRenderingFeatures.conditionalRendering = VK_TRUE;
+            conditionalRenderingFeatures.setPNext(featureChain);
+            featureChain = &conditionalRenderingFeatures;
+        }
+        deviceInfo.setPNext(featureChain);
+        return pDevice.createDevice(deviceInfo);
     }
 
     vk::CommandPool TGAVulkan::createCommandPool(uint32_t queueFamily, vk::CommandPoolCreateFlags flags)
@@ -93,6 +149,7 @@ namespace tga
         while (wsi.windows.size() > 0) free(wsi.windows.begin()->first);
         while (inputSets.size() > 0) free(inputSets.begin()->first);
         while (renderPasses.size() > 0) free(renderPasses.begin()->first);
+        while (queryPools.size() > 0) free(queryPools.begin()->first);
         device.destroy(transferCmdPool);
         device.destroy(graphicsCmdPool);
         device.destroy();
@@ -103,11 +160,25 @@ namespace tga
     /*Interface Methodes*/
     Shader TGAVulkan::createShader(const ShaderInfo &shaderInfo)
     {
+        // Identical code is only turned into a module once, every further user just holds a reference
+        size_t codeHash = std::hash<std::string_view>()(
+            std::string_view(reinterpret_cast<const char *>(shaderInfo.src), shaderInfo.srcSize));
+        auto [first, last] = shaderCache.equal_range(codeHash);
+        for (auto it = first; it != last; it++) {
+            auto &shader = shaders[it->second];
+            if (shader.type == shaderInfo.type && shader.code.size() == shaderInfo.srcSize &&
+                std::memcmp(shader.code.data(), shaderInfo.src, shaderInfo.srcSize) == 0) {
+                shader.refCount++;
+                return it->second;
+            }
+        }
         vk::ShaderModule module =
             device.createShaderModule({{}, shaderInfo.srcSize, reinterpret_cast<const uint32_t *>(shaderInfo.src)});
         Shader handle = Shader(TgaShader(VkShaderModule(module)));
-        Shader_TV shader{module, shaderInfo.type};
+        Shader_TV shader{module, shaderInfo.type, codeHash,
+                         std::vector<uint8_t>(shaderInfo.src, shaderInfo.src + shaderInfo.srcSize), 1};
         shaders.emplace(handle, shader);
+        shaderCache.emplace(codeHash, handle);
         return handle;
     }
     Buffer TGAVulkan::createBuffer(const BufferInfo &bufferInfo)
@@ -119,6 +190,33 @@ namespace tga
         if (bufferInfo.data != nullptr) fillBuffer(bufferInfo.dataSize, bufferInfo.data, 0, buffer.buffer);
         return handle;
     }
+    Buffer TGAVulkan::createBuffer(const BufferInfo &bufferInfo, std::function<void(uint8_t *data)> const &fill)
+    {
+        if (bufferInfo.data != nullptr)
+            throw std::runtime_error("[TGA Vulkan] A Buffer with a fill function can't have data as well");
+        auto staging =
+            allocateBuffer(bufferInfo.dataSize, vk::BufferUsageFlagBits::eTransferSrc,
+                           vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+        auto mapping = static_cast<uint8_t *>(device.mapMemory(staging.memory, 0, bufferInfo.dataSize, {}));
+        try {
+            fill(mapping);
+        } catch (...) {
+            device.unmapMemory(staging.memory);
+            device.destroy(staging.buffer);
+            device.free(staging.memory);
+            throw;
+        }
+        device.unmapMemory(staging.memory);
+
+        Buffer handle = createBuffer({bufferInfo.usage, nullptr, bufferInfo.dataSize});
+        auto copyCmdBuffer = beginOneTimeCmdBuffer(transferCmdPool);
+        vk::BufferCopy region{0, 0, bufferInfo.dataSize};
+        copyCmdBuffer.copyBuffer(staging.buffer, buffers[handle].buffer, {region});
+        endOneTimeCmdBuffer(copyCmdBuffer, transferCmdPool, transferQueue);
+        device.destroy(staging.buffer);
+        device.free(staging.memory);
+        return handle;
+    }
     Texture TGAVulkan::createTexture(const TextureInfo &textureInfo)
     {
         vk::Format format = determineImageFormat(textureInfo.format);
@@ -127,18 +225,28 @@ namespace tga
 
         auto [tiling, usageFlags] = determineImageFeatures(format);
 
-        vk::Image image = device.createImage({flags, imageType, format, extent, 1, layers, vk::SampleCountFlagBits::e1,
-                                              tiling, usageFlags, vk::SharingMode::eExclusive});
+        // The full chain has floor(log2(largest extent)) + 1 levels
+        uint32_t mipLevels = textureInfo.mipLevels;
+        uint32_t chainLength = 1;
+        for (uint32_t size = std::max({extent.width, extent.height, extent.depth}); size > 1; size >>= 1) chainLength++;
+        if (mipLevels == 0 || mipLevels > chainLength)
+            throw std::runtime_error("[TGA Vulkan] Texture has more mip levels than its dimensions allow");
+
+        vk::Image image = device.createImage({flags, imageType, format, extent, mipLevels, layers,
+                                              vk::SampleCountFlagBits::e1, tiling, usageFlags,
+                                              vk::SharingMode::eExclusive});
         auto mr = device.getImageMemoryRequirements(image);
         vk::DeviceMemory memory = device.allocateMemory(
             {mr.size, findMemoryType(mr.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal)});
         device.bindImageMemory(image, memory, 0);
         vk::ImageView view = device.createImageView(
-            {{}, image, imageViewType, format, {}, {vk::ImageAspectFlagBits::eColor, 0, 1, 0, layers}});
+            {{}, image, imageViewType, format, {}, {vk::ImageAspectFlagBits::eColor, 0, mipLevels, 0, layers}});
 
         auto [filter, addressMode] = determineSamplerInfo(textureInfo);
-        vk::Sampler sampler = device.createSampler(
-            {{}, filter, filter, vk::SamplerMipmapMode::eLinear, addressMode, addressMode, addressMode});
+        vk::SamplerCreateInfo samplerInfo{
+            {}, filter, filter, vk::SamplerMipmapMode::eLinear, addressMode, addressMode, addressMode};
+        samplerInfo.maxLod = float(mipLevels - 1);
+        vk::Sampler sampler = device.createSampler(samplerInfo);
         Texture_TV texture{image, view, memory, sampler, extent, format};
         Texture handle = Texture(TgaTexture(VkImage(image)));
         textures.emplace(handle, texture);
@@ -148,7 +256,7 @@ namespace tga
             transitionImageLayout(transitionCmdBuffer, image, vk::ImageLayout::eUndefined,
                                   vk::ImageLayout::eTransferDstOptimal);
             endOneTimeCmdBuffer(transitionCmdBuffer, graphicsCmdPool, graphicsQueue);
-            fillTexture(textureInfo.dataSize, textureInfo.data, extent, layers, image);
+            fillTexture(textureInfo.dataSize, textureInfo.data, extent, layers, image, {}, mipLevels);
             transitionCmdBuffer = beginOneTimeCmdBuffer(graphicsCmdPool);
             transitionImageLayout(transitionCmdBuffer, image, vk::ImageLayout::eTransferDstOptimal,
                                   vk::ImageLayout::eGeneral);
@@ -176,59 +284,130 @@ namespace tga
         if (renderPasses[inputSetInfo.targetRenderPass].setLayouts.size() <= inputSetInfo.setIndex)
             throw std::runtime_error("[TGA Vulkan] InputSet does not match layout from RenderPass");
 
-        uint32_t uniformCount = 0;
-        uint32_t storageCount = 0;
-        uint32_t textureCount = 0;
-        for (auto &binding : inputSetInfo.bindings) {
-            if (auto handle = std::get_if<Buffer>(&binding.resource)) {
-                const auto &buffer = buffers[*handle];
-                if (buffer.flags & vk::BufferUsageFlagBits::eUniformBuffer) uniformCount++;
-                if (buffer.flags & vk::BufferUsageFlagBits::eStorageBuffer) storageCount++;
-            } else
-                textureCount++;
+        auto &renderPass = renderPasses[inputSetInfo.targetRenderPass];
+        const auto &setLayout = renderPass.inputLayout.setLayouts[inputSetInfo.setIndex];
+
+        // Partially bound arrays still need room for every element, so the pool is sized after the layout
+        std::unordered_map<vk::DescriptorType, uint32_t> descriptorCounts{};
+        bool updateAfterBind = false;
+        for (auto &bindingLayout : setLayout.bindingLayouts) {
+            descriptorCounts[determineDescriptorType(bindingLayout.type)] += bindingLayout.count;
+            updateAfterBind |= bindingLayout.bindless && descriptorIndexing;
         }
         std::vector<vk::DescriptorPoolSize> poolSizes{};
-        if (uniformCount > 0)
-            poolSizes.emplace_back(vk::DescriptorPoolSize(vk::DescriptorType::eUniformBuffer, uniformCount));
-        if (storageCount > 0)
-            poolSizes.emplace_back(vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer, storageCount));
-        if (textureCount > 0)
-            poolSizes.emplace_back(vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, textureCount));
+        for (auto [type, count] : descriptorCounts) poolSizes.emplace_back(vk::DescriptorPoolSize(type, count));
 
+        vk::DescriptorPoolCreateFlags poolFlags{};
+        if (updateAfterBind) poolFlags |= vk::DescriptorPoolCreateFlagBits::eUpdateAfterBindEXT;
         vk::DescriptorPool descPool =
-            device.createDescriptorPool({{}, 1, uint32_t(poolSizes.size()), poolSizes.data()});
+            device.createDescriptorPool({poolFlags, 1, uint32_t(poolSizes.size()), poolSizes.data()});
 
-        auto layout = renderPasses[inputSetInfo.targetRenderPass].setLayouts[inputSetInfo.setIndex];
+        auto layout = renderPass.setLayouts[inputSetInfo.setIndex];
         vk::DescriptorSet descSet = device.allocateDescriptorSets({descPool, 1, &layout})[0];
-        for (auto &binding : inputSetInfo.bindings) {
-            if (auto resource = std::get_if<Buffer>(&binding.resource)) {
-                auto &buffer = buffers[*resource];
-                vk::DescriptorBufferInfo bufferInfo{buffer.buffer, 0, VK_WHOLE_SIZE};
-                vk::WriteDescriptorSet writeSet{
-                    descSet,
-                    binding.slot,
-                    binding.arrayElement,
-                    1,
-                    (buffer.flags & vk::BufferUsageFlagBits::eStorageBuffer ? vk::DescriptorType::eStorageBuffer
-                                                                            : vk::DescriptorType::eUniformBuffer),
-                    {},
-                    &bufferInfo};
-                device.updateDescriptorSets({writeSet}, {});
-            } else if (auto resource = std::get_if<Texture>(&binding.resource)) {
-                auto &texture = textures[*resource];
-                vk::DescriptorImageInfo imageInfo{texture.sampler, texture.imageView, vk::ImageLayout::eGeneral};
-                vk::WriteDescriptorSet writeSet{
-                    descSet,   binding.slot, binding.arrayElement, 1, vk::DescriptorType::eCombinedImageSampler,
-                    &imageInfo};
-                device.updateDescriptorSets({writeSet}, {});
+        InputSet_TV inputSet_tv{descPool, descSet, inputSetInfo.setIndex, setLayout};
+        writeBindings(inputSet_tv, inputSetInfo.bindings);
+
+        if (!descriptorIndexing) {
+            // Plain arrays have to be complete, so missing elements repeat the first bound one
+            std::vector<Binding> fillers{};
+            for (uint32_t slot = 0; slot < setLayout.bindingLayouts.size(); slot++) {
+                if (!setLayout.bindingLayouts[slot].bindless) continue;
+                std::vector<bool> bound(setLayout.bindingLayouts[slot].count, false);
+                Binding const *first = nullptr;
+                for (auto &binding : inputSetInfo.bindings) {
+                    if (binding.slot != slot) continue;
+                    if (!first) first = &binding;
+                    bound[binding.arrayElement] = true;
+                }
+                if (!first)
+                    throw std::runtime_error(
+                        "[TGA Vulkan] Bindless binding needs at least one element without descriptor indexing");
+                for (uint32_t i = 0; i < bound.size(); i++)
+                    if (!bound[i]) fillers.emplace_back(first->resource, slot, i);
             }
+            writeBindings(inputSet_tv, fillers);
         }
         InputSet inputSet = InputSet(TgaInputSet(VkDescriptorPool(descPool)));
-        InputSet_TV inputSet_tv{descPool, descSet, inputSetInfo.setIndex};
         inputSets.emplace(inputSet, inputSet_tv);
         return inputSet;
     }
     RenderPass TGAVulkan::createRenderPass(const RenderPassInfo &renderPassInfo)
+    {
+        return createRenderPasses({renderPassInfo}).front();
+    }
+    std::vector<RenderPass> TGAVulkan::createRenderPasses(const std::vector<RenderPassInfo> &renderPassInfos)
+    {
+        // Everything but the pipelines touches the bookkeeping and is cheap, so it stays on this thread
+        std::vector<RenderPass_TV> renderPass_tvs{};
+        try {
+            for (auto &renderPassInfo : renderPassInfos)
+                renderPass_tvs.emplace_back(prepareRenderPass(renderPassInfo));
+        } catch (...) {
+            for (auto &renderPass_tv : renderPass_tvs) destroyRenderPass(renderPass_tv);
+            throw;
+        }
+
+        // Pipeline compilation only reads the bookkeeping and dominates the creation time, so it runs in parallel
+        std::exception_ptr error;
+        std::vector<std::future<std::pair<vk::Pipeline, vk::PipelineBindPoint>>> pipelines{};
+        try {
+            for (size_t i = 0; i < renderPassInfos.size(); i++) {
+                auto compile = [this, &renderPassInfos, &renderPass_tvs, i] {
+                    return makePipeline(renderPassInfos[i], renderPass_tvs[i].pipelineLayout,
+                                        renderPass_tvs[i].renderPass);
+                };
+                auto policy = renderPassInfos.size() > 1 ? std::launch::async : std::launch::deferred;
+                pipelines.emplace_back(std::async(policy, compile));
+            }
+        } catch (...) {
+            error = std::current_exception();
+        }
+        // All compilations have to finish before the batch is registered or torn down, they read renderPass_tvs
+        for (size_t i = 0; i < pipelines.size(); i++) {
+            try {
+                std::tie(renderPass_tvs[i].pipeline, renderPass_tvs[i].bindPoint) = pipelines[i].get();
+            } catch (...) {
+                if (!error) error = std::current_exception();
+            }
+        }
+        if (error) {
+            for (auto &renderPass_tv : renderPass_tvs) destroyRenderPass(renderPass_tv);
+            std::rethrow_exception(error);
+        }
+
+        std::vector<RenderPass> handles{};
+        for (auto &renderPass_tv : renderPass_tvs) {
+            RenderPass handle = RenderPass(TgaRenderPass(VkRenderPass(renderPass_tv.renderPass)));
+            renderPasses.emplace(handle, renderPass_tv);
+            handles.push_back(handle);
+        }
+        return handles;
+    }
+    QueryPool TGAVulkan::createQueryPool(const QueryPoolInfo &queryPoolInfo)
+    {
+        if (queryPoolInfo.queryCount == 0) throw std::runtime_error("[TGA Vulkan] A QueryPool needs queries");
+        vk::QueryPool pool = device.createQueryPool({{}, vk::QueryType::eOcclusion, queryPoolInfo.queryCount});
+        // Until the first results arrive everything is visible
+        QueryPool_TV queryPool{pool, queryPoolInfo.queryCount, std::vector<uint64_t>(queryPoolInfo.queryCount, 1), {}};
+        if (conditionalRendering) {
+            std::vector<uint32_t> visible(queryPoolInfo.queryCount, 1);
+            queryPool.predicates = allocateBuffer(
+                visible.size() * sizeof(uint32_t),
+                vk::BufferUsageFlagBits::eConditionalRenderingEXT | vk::BufferUsageFlagBits::eTransferDst,
+                vk::MemoryPropertyFlagBits::eDeviceLocal);
+            fillBuffer(visible.size() * sizeof(uint32_t), reinterpret_cast<const uint8_t *>(visible.data()), 0,
+                       queryPool.predicates.buffer);
+        }
+        // Queries have to be reset before their first use and before their results are copied
+        auto resetCmdBuffer = beginOneTimeCmdBuffer(graphicsCmdPool);
+        resetCmdBuffer.resetQueryPool(pool, 0, queryPoolInfo.queryCount);
+        endOneTimeCmdBuffer(resetCmdBuffer, graphicsCmdPool, graphicsQueue);
+
+        QueryPool handle = QueryPool(TgaQueryPool(VkQueryPool(pool)));
+        queryPools.emplace(handle, std::move(queryPool));
+        return handle;
+    }
+    RenderPass_TV TGAVulkan::prepareRenderPass(const RenderPassInfo &renderPassInfo)
     {
         vk::RenderPass renderPass;
         std::vector<vk::Framebuffer> framebuffers;
@@ -271,11 +450,17 @@ namespace tga
         std::vector<vk::DescriptorSetLayout> setLayouts = decodeInputLayout(renderPassInfo.inputLayout);
 
         auto pipelineLayout = device.createPipelineLayout({{}, uint32_t(setLayouts.size()), setLayouts.data()});
-        auto [pipeline, bindPoint] = makePipeline(renderPassInfo, pipelineLayout, renderPass);
-        RenderPass_TV renderPass_tv{framebuffers, renderPass, setLayouts, pipelineLayout, pipeline, bindPoint, area};
-        RenderPass handle = RenderPass(TgaRenderPass(VkRenderPass(renderPass)));
-        renderPasses.emplace(handle, renderPass_tv);
-        return handle;
+        return {framebuffers, renderPass, setLayouts, renderPassInfo.inputLayout, pipelineLayout, {}, {}, area};
+    }
+
+    void TGAVulkan::destroyRenderPass(RenderPass_TV &renderPass)
+    {
+        // Handles that were never created are null, destroying them does nothing
+        for (auto &fb : renderPass.framebuffers) device.destroy(fb);
+        device.destroy(renderPass.renderPass);
+        for (auto &sl : renderPass.setLayouts) device.destroy(sl);
+        device.destroy(renderPass.pipeline);
+        device.destroy(renderPass.pipelineLayout);
     }
 
     void TGAVulkan::beginCommandBuffer()
@@ -297,15 +482,15 @@ namespace tga
         currentRecording.cmdBuffer = handle.cmdBuffer;
         handle.cmdBuffer.begin({vk::CommandBufferUsageFlagBits::eSimultaneousUse});
     }
-    void TGAVulkan::bindVertexBuffer(Buffer buffer)
+    void TGAVulkan::bindVertexBuffer(Buffer buffer, size_t offset)
     {
         auto &handle = buffers[buffer];
-        currentRecording.cmdBuffer.bindVertexBuffers(0, {handle.buffer}, {0});
+        currentRecording.cmdBuffer.bindVertexBuffers(0, {handle.buffer}, {vk::DeviceSize(offset)});
     }
-    void TGAVulkan::bindIndexBuffer(Buffer buffer)
+    void TGAVulkan::bindIndexBuffer(Buffer buffer, IndexType indexType, size_t offset)
     {
         auto &handle = buffers[buffer];
-        currentRecording.cmdBuffer.bindIndexBuffer(handle.buffer, 0, vk::IndexType::eUint32);
+        currentRecording.cmdBuffer.bindIndexBuffer(handle.buffer, offset, determineIndexType(indexType));
     }
 
     void TGAVulkan::bindInputSet(InputSet inputSet)
@@ -318,16 +503,118 @@ namespace tga
     }
     void TGAVulkan::draw(uint32_t vertexCount, uint32_t firstVertex, uint32_t instanceCount, uint32_t firstInstance)
     {
+        if (currentRecording.skipDraws) return;
         currentRecording.cmdBuffer.draw(vertexCount, instanceCount, firstVertex, firstInstance);
     }
     void TGAVulkan::drawIndexed(uint32_t indexCount, uint32_t firstIndex, uint32_t vertexOffset, uint32_t instanceCount,
                                 uint32_t firstInstance)
     {
+        if (currentRecording.skipDraws) return;
         currentRecording.cmdBuffer.drawIndexed(indexCount, instanceCount, firstIndex, vertexOffset, firstInstance);
     }
     void TGAVulkan::dispatch(uint32_t groupCountX, uint32_t groupCountY, uint32_t groupCountZ)
     {
+        if (currentRecording.skipDraws) return;
         currentRecording.cmdBuffer.dispatch(groupCountX, groupCountY, groupCountZ);
+        // Compute passes are mostly chained, one global barrier after every dispatch keeps the Interface free of
+        // explicit synchronization
+        vk::MemoryBarrier barrier{vk::AccessFlagBits::eShaderWrite,
+                                  vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite |
+                                      vk::AccessFlagBits::eVertexAttributeRead | vk::AccessFlagBits::eIndexRead |
+                                      vk::AccessFlagBits::eIndirectCommandRead | vk::AccessFlagBits::eTransferRead};
+        currentRecording.cmdBuffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eComputeShader,
+            vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eDrawIndirect |
+                vk::PipelineStageFlagBits::eVertexInput | vk::PipelineStageFlagBits::eVertexShader |
+                vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eTransfer,
+            {}, {barrier}, {}, {});
+    }
+
+    void TGAVulkan::drawIndexedIndirect(Buffer indirectBuffer, uint32_t drawCount, size_t offset)
+    {
+        if (currentRecording.skipDraws) return;
+        auto &handle = buffers.at(indirectBuffer);
+        constexpr uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+        if (offset + size_t(drawCount) * stride > handle.size)
+            throw std::runtime_error("[TGA Vulkan] Indirect draws exceed the buffer");
+        if (features.multiDrawIndirect || drawCount <= 1) {
+            currentRecording.cmdBuffer.drawIndexedIndirect(handle.buffer, offset, drawCount, stride);
+            return;
+        }
+        for (uint32_t i = 0; i < drawCount; i++)
+            currentRecording.cmdBuffer.drawIndexedIndirect(handle.buffer, offset + i * stride, 1, stride);
+    }
+
+    void TGAVulkan::copyBufferToTexture(Buffer buffer, Texture texture, uint32_t rowLength)
+    {
+        if (currentRecording.renderPass &&
+            renderPasses[currentRecording.renderPass].bindPoint == vk::PipelineBindPoint::eGraphics)
+            throw std::runtime_error("[TGA Vulkan] Textures can't be copied inside of a RenderPass");
+        auto &source = buffers.at(buffer);
+        auto &target = textures.at(texture);
+        auto &cmd = currentRecording.cmdBuffer;
+        transitionImageLayout(cmd, target.image, vk::ImageLayout::eGeneral, vk::ImageLayout::eTransferDstOptimal);
+        vk::BufferImageCopy region{0, rowLength, 0, {vk::ImageAspectFlagBits::eColor, 0, 0, 1}, {}, target.extent};
+        cmd.copyBufferToImage(source.buffer, target.image, vk::ImageLayout::eTransferDstOptimal, {region});
+        transitionImageLayout(cmd, target.image, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eGeneral);
+    }
+    void TGAVulkan::resetQueries(QueryPool queryPool)
+    {
+        if (currentRecording.renderPass &&
+            renderPasses[currentRecording.renderPass].bindPoint == vk::PipelineBindPoint::eGraphics)
+            throw std::runtime_error("[TGA Vulkan] Queries can't be reset inside of a RenderPass");
+        auto &handle = queryPools.at(queryPool);
+        auto &cmd = currentRecording.cmdBuffer;
+        // The previous submission has finished once the next one is recorded, this never waits
+        updateOcclusionResults(handle);
+        if (conditionalRendering) {
+            // Unavailable queries are not written, so their predicate keeps the last known result
+            cmd.copyQueryPoolResults(handle.queryPool, 0, handle.queryCount, handle.predicates.buffer, 0,
+                                     sizeof(uint32_t), {});
+            vk::BufferMemoryBarrier barrier{vk::AccessFlagBits::eTransferWrite,
+                                            vk::AccessFlagBits::eConditionalRenderingReadEXT,
+                                            VK_QUEUE_FAMILY_IGNORED,
+                                            VK_QUEUE_FAMILY_IGNORED,
+                                            handle.predicates.buffer,
+                                            0,
+                                            VK_WHOLE_SIZE};
+            cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                vk::PipelineStageFlagBits::eConditionalRenderingEXT, {}, {}, {barrier}, {});
+        }
+        cmd.resetQueryPool(handle.queryPool, 0, handle.queryCount);
+    }
+    void TGAVulkan::beginOcclusionQuery(QueryPool queryPool, uint32_t query)
+    {
+        currentRecording.cmdBuffer.beginQuery(queryPools.at(queryPool).queryPool, query, {});
+    }
+    void TGAVulkan::endOcclusionQuery(QueryPool queryPool, uint32_t query)
+    {
+        currentRecording.cmdBuffer.endQuery(queryPools.at(queryPool).queryPool, query);
+    }
+    void TGAVulkan::beginConditionalRendering(QueryPool queryPool, uint32_t query)
+    {
+        if (currentRecording.conditional)
+            throw std::runtime_error("[TGA Vulkan] Conditional rendering can't be nested");
+        auto &handle = queryPools.at(queryPool);
+        if (query >= handle.queryCount) throw std::runtime_error("[TGA Vulkan] Query index out of range");
+        currentRecording.conditional = true;
+        if (conditionalRendering) {
+            VkConditionalRenderingBeginInfoEXT beginInfo{VK_STRUCTURE_TYPE_CONDITIONAL_RENDERING_BEGIN_INFO_EXT,
+                                                         nullptr, static_cast<VkBuffer>(handle.predicates.buffer),
+                                                         query * sizeof(uint32_t), 0};
+            pfnCmdBeginConditionalRendering(static_cast<VkCommandBuffer>(currentRecording.cmdBuffer), &beginInfo);
+        } else {
+            currentRecording.skipDraws = handle.samples[query] == 0;
+        }
+    }
+    void TGAVulkan::endConditionalRendering()
+    {
+        if (!currentRecording.conditional)
+            throw std::runtime_error("[TGA Vulkan] No conditional rendering to end");
+        if (conditionalRendering)
+            pfnCmdEndConditionalRendering(static_cast<VkCommandBuffer>(currentRecording.cmdBuffer));
+        currentRecording.conditional = false;
+        currentRecording.skipDraws = false;
     }
 
     void TGAVulkan::setRenderPass(RenderPass renderPass, uint32_t framebufferIndex)
@@ -362,6 +649,8 @@ namespace tga
     }
     CommandBuffer TGAVulkan::endCommandBuffer()
     {
+        if (currentRecording.conditional)
+            throw std::runtime_error("[TGA Vulkan] Conditional rendering was not ended");
         if (currentRecording.renderPass) {
             if (renderPasses[currentRecording.renderPass].bindPoint == vk::PipelineBindPoint::eGraphics)
                 currentRecording.cmdBuffer.endRenderPass();
@@ -386,8 +675,28 @@ namespace tga
         fillBuffer(dataSize, data, offset, handle.buffer);
     }
 
+    void TGAVulkan::updateTexture(Texture texture, uint8_t const *data, size_t dataSize, uint32_t offsetX,
+                                  uint32_t offsetY, uint32_t width, uint32_t height)
+    {
+        auto &handle = textures[texture];
+        if (offsetX + width > handle.extent.width || offsetY + height > handle.extent.height)
+            throw std::runtime_error("[TGA Vulkan] Texture update exceeds the texture");
+        auto transitionCmdBuffer = beginOneTimeCmdBuffer(graphicsCmdPool);
+        transitionImageLayout(transitionCmdBuffer, handle.image, vk::ImageLayout::eGeneral,
+                              vk::ImageLayout::eTransferDstOptimal);
+        endOneTimeCmdBuffer(transitionCmdBuffer, graphicsCmdPool, graphicsQueue);
+        fillTexture(dataSize, data, {width, height, 1}, 1, handle.image,
+                    {int32_t(offsetX), int32_t(offsetY), 0});
+        transitionCmdBuffer = beginOneTimeCmdBuffer(graphicsCmdPool);
+        transitionImageLayout(transitionCmdBuffer, handle.image, vk::ImageLayout::eTransferDstOptimal,
+                              vk::ImageLayout::eGeneral);
+        endOneTimeCmdBuffer(transitionCmdBuffer, graphicsCmdPool, graphicsQueue);
+    }
+
     std::vector<uint8_t> TGAVulkan::readback(Buffer buffer)
     {
+        // Executed command buffers may still write the buffer
+        graphicsQueue.waitIdle();
         auto &handle = buffers[buffer];
         std::vector<uint8_t> rbBuffer{};
         rbBuffer.resize(handle.size);
@@ -410,6 +719,7 @@ namespace tga
 
     std::vector<uint8_t> TGAVulkan::readback(Texture texture)
     {
+        graphicsQueue.waitIdle();
         auto &handle = textures[texture];
         auto mr = device.getImageMemoryRequirements(handle.image);
         std::vector<uint8_t> rbBuffer{};
@@ -464,6 +774,26 @@ namespace tga
         endOneTimeCmdBuffer(cmdBuffer, graphicsCmdPool, graphicsQueue);
     }
 
+    void TGAVulkan::updateInputSet(InputSet inputSet, std::vector<Binding> const &bindings)
+    {
+        // Without update after bind the descriptor set must not be in use
+        if (!descriptorIndexing) device.waitIdle();
+        writeBindings(inputSets[inputSet], bindings);
+    }
+
+    bool TGAVulkan::bindlessSupported() { return descriptorIndexing; }
+
+    bool TGAVulkan::indirectFirstInstanceSupported() { return features.drawIndirectFirstInstance; }
+
+    std::vector<uint64_t> TGAVulkan::occlusionResults(QueryPool queryPool)
+    {
+        auto &handle = queryPools.at(queryPool);
+        updateOcclusionResults(handle);
+        return handle.samples;
+    }
+
+    bool TGAVulkan::conditionalRenderingSupported() { return conditionalRendering; }
+
     void TGAVulkan::setWindowTitle(Window window, const std::string &title)
     {
         wsi.setWindowTitle(window, title.c_str());
@@ -479,8 +809,18 @@ namespace tga
 
     void TGAVulkan::free(Shader shader)
     {
+        auto found = shaders.find(shader);
+        if (found == shaders.end()) throw std::runtime_error("[TGA Vulkan] Shader was already freed or never created");
+        auto &handle = found->second;
+        if (--handle.refCount > 0) return;
         device.waitIdle();
-        auto &handle = shaders[shader];
+        auto [first, last] = shaderCache.equal_range(handle.codeHash);
+        for (auto it = first; it != last; it++) {
+            if (it->second == shader) {
+                shaderCache.erase(it);
+                break;
+            }
+        }
         device.destroy(handle.module);
         shaders.erase(shader);
     }
@@ -531,12 +871,7 @@ namespace tga
     void TGAVulkan::free(RenderPass renderPass)
     {
         device.waitIdle();
-        auto &handle = renderPasses[renderPass];
-        for (auto &fb : handle.framebuffers) device.destroy(fb);
-        device.destroy(handle.renderPass);
-        for (auto &sl : handle.setLayouts) device.destroy(sl);
-        device.destroy(handle.pipeline);
-        device.destroy(handle.pipelineLayout);
+        destroyRenderPass(renderPasses[renderPass]);
         renderPasses.erase(renderPass);
     }
     void TGAVulkan::free(CommandBuffer commandBuffer)
@@ -546,6 +881,17 @@ namespace tga
         device.freeCommandBuffers(graphicsCmdPool, {handle.cmdBuffer});
         commandBuffers.erase(commandBuffer);
     }
+    void TGAVulkan::free(QueryPool queryPool)
+    {
+        device.waitIdle();
+        auto &handle = queryPools[queryPool];
+        device.destroy(handle.queryPool);
+        if (handle.predicates.buffer) {
+            device.destroy(handle.predicates.buffer);
+            device.free(handle.predicates.memory);
+        }
+        queryPools.erase(queryPool);
+    }
 
     /*Quality of life functions*/
 
@@ -558,6 +904,8 @@ namespace tga
     const std::vector<const char *> TGAVulkan::getDeviceExtentensions()
     {
         std::vector<const char *> deviceExtensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+        if (descriptorIndexing) deviceExtensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+        if (conditionalRendering) deviceExtensions.push_back(VK_EXT_CONDITIONAL_RENDERING_EXTENSION_NAME);
         return deviceExtensions;
     }
     const std::vector<const char *> TGAVulkan::getLayers()
@@ -567,9 +915,15 @@ namespace tga
     }
     vk::PhysicalDeviceFeatures TGAVulkan::getDeviceFeatures()
     {
-        vk::PhysicalDeviceFeatures features;
-        features.fillModeNonSolid = VK_TRUE;
-        return features;
+        vk::PhysicalDeviceFeatures enabled;
+        enabled.fillModeNonSolid = VK_TRUE;
+        // Optional, drawIndexedIndirect falls back to one call per draw without multiDrawIndirect
+        auto supported = pDevice.getFeatures();
+        enabled.multiDrawIndirect = supported.multiDrawIndirect;
+        enabled.drawIndirectFirstInstance = supported.drawIndirectFirstInstance;
+        // Sampler arrays indexed with dynamically uniform values, bindless needs it, see findDescriptorIndexingSupport
+        enabled.shaderSampledImageArrayDynamicIndexing = supported.shaderSampledImageArrayDynamicIndexing;
+        return enabled;
     }
 
     uint32_t TGAVulkan::findMemoryType(uint32_t typeFilter, vk::MemoryPropertyFlags properties)
@@ -728,25 +1082,74 @@ namespace tga
         std::vector<vk::DescriptorSetLayout> descSetLayouts{};
         for (const auto &setLayout : inputLayout.setLayouts) {
             std::vector<vk::DescriptorSetLayoutBinding> bindings{};
+            std::vector<vk::DescriptorBindingFlagsEXT> bindingFlags{};
+            vk::DescriptorSetLayoutCreateFlags layoutFlags{};
             for (uint32_t i = 0; i < setLayout.bindingLayouts.size(); i++) {
-                bindings.emplace_back(
-                    vk::DescriptorSetLayoutBinding{i, determineDescriptorType(setLayout.bindingLayouts[i].type),
-                                                   setLayout.bindingLayouts[i].count, vk::ShaderStageFlagBits::eAll});
+                const auto &bindingLayout = setLayout.bindingLayouts[i];
+                bindings.emplace_back(vk::DescriptorSetLayoutBinding{i, determineDescriptorType(bindingLayout.type),
+                                                                     bindingLayout.count,
+                                                                     vk::ShaderStageFlagBits::eAll});
+                if (bindingLayout.bindless && bindingLayout.type == BindingType::uniformBuffer)
+                    throw std::runtime_error("[TGA Vulkan] Bindless bindings are only supported for samplers and "
+                                             "storage buffers");
+                if (bindingLayout.bindless && descriptorIndexing) {
+                    bindingFlags.emplace_back(vk::DescriptorBindingFlagBitsEXT::ePartiallyBound |
+                                              vk::DescriptorBindingFlagBitsEXT::eUpdateAfterBind |
+                                              vk::DescriptorBindingFlagBitsEXT::eUpdateUnusedWhilePending);
+                    layoutFlags = vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPoolEXT;
+                } else
+                    bindingFlags.emplace_back();
             }
-            descSetLayouts.emplace_back(
-                device.createDescriptorSetLayout({{}, uint32_t(bindings.size()), bindings.data()}));
+            vk::DescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsInfo{uint32_t(bindingFlags.size()),
+                                                                              bindingFlags.data()};
+            vk::DescriptorSetLayoutCreateInfo layoutInfo{layoutFlags, uint32_t(bindings.size()), bindings.data()};
+            if (layoutFlags) layoutInfo.setPNext(&bindingFlagsInfo);
+            descSetLayouts.emplace_back(device.createDescriptorSetLayout(layoutInfo));
         }
         return descSetLayouts;
     }
 
+    void TGAVulkan::writeBindings(InputSet_TV &inputSet, std::vector<Binding> const &bindings)
+    {
+        std::vector<vk::DescriptorBufferInfo> bufferInfos{};
+        std::vector<vk::DescriptorImageInfo> imageInfos{};
+        std::vector<vk::WriteDescriptorSet> writeSets{};
+        bufferInfos.reserve(bindings.size());
+        imageInfos.reserve(bindings.size());
+        for (auto &binding : bindings) {
+            if (binding.slot >= inputSet.layout.bindingLayouts.size() ||
+                binding.arrayElement >= inputSet.layout.bindingLayouts[binding.slot].count)
+                throw std::runtime_error("[TGA Vulkan] Binding does not match layout from RenderPass");
+            if (auto resource = std::get_if<Buffer>(&binding.resource)) {
+                auto &buffer = buffers[*resource];
+                bufferInfos.emplace_back(buffer.buffer, 0, VK_WHOLE_SIZE);
+                writeSets.emplace_back(inputSet.descriptorSet, binding.slot, binding.arrayElement, 1,
+                                       (buffer.flags & vk::BufferUsageFlagBits::eStorageBuffer
+                                            ? vk::DescriptorType::eStorageBuffer
+                                            : vk::DescriptorType::eUniformBuffer),
+                                       nullptr, &bufferInfos.back());
+            } else if (auto resource = std::get_if<Texture>(&binding.resource)) {
+                auto &texture = textures[*resource];
+                imageInfos.emplace_back(texture.sampler, texture.imageView, vk::ImageLayout::eGeneral);
+                writeSets.emplace_back(inputSet.descriptorSet, binding.slot, binding.arrayElement, 1,
+                                       vk::DescriptorType::eCombinedImageSampler, &imageInfos.back());
+            }
+        }
+        device.updateDescriptorSets(writeSets, {});
+    }
+
     vk::Pipeline TGAVulkan::makeGraphicsPipeline(const RenderPassInfo &renderPassInfo,
                                                  vk::PipelineLayout pipelineLayout, vk::RenderPass renderPass)
     {
         std::vector<vk::PipelineShaderStageCreateInfo> shaderStages{};
-        for (auto &stage : renderPassInfo.shaderStages) {
-            auto &shader = shaders[stage];
-            shaderStages.emplace_back(
-                vk::PipelineShaderStageCreateInfo({}, determineShaderStage(shader.type), shader.module, "main"));
+        std::vector<std::vector<vk::SpecializationMapEntry>> mapEntries(renderPassInfo.shaderStages.size());
+        std::vector<vk::SpecializationInfo> specializationInfos(renderPassInfo.shaderStages.size());
+        for (size_t i = 0; i < renderPassInfo.shaderStages.size(); i++) {
+            auto &shader = shaders.at(renderPassInfo.shaderStages[i]);
+            auto specializationInfo = determineSpecializationInfo(renderPassInfo, shader.type, mapEntries[i],
+                                                                  specializationInfos[i]);
+            shaderStages.emplace_back(vk::PipelineShaderStageCreateInfo(
+                {}, determineShaderStage(shader.type), shader.module, "main", specializationInfo));
         }
         vk::VertexInputBindingDescription vertexBinding{0, uint32_t(renderPassInfo.vertexLayout.vertexSize),
                                                         vk::VertexInputRate::eVertex};
@@ -767,8 +1170,9 @@ namespace tga
         vk::PipelineMultisampleStateCreateInfo multisampling{};
         vk::Bool32 depthTest =
             (renderPassInfo.perPixelOperations.depthCompareOp != CompareOperation::ignore) ? VK_TRUE : VK_FALSE;
+        vk::Bool32 depthWrite = depthTest && renderPassInfo.perPixelOperations.writeEnabled ? VK_TRUE : VK_FALSE;
         auto compOp = determineDepthCompareOp(renderPassInfo.perPixelOperations.depthCompareOp);
-        vk::PipelineDepthStencilStateCreateInfo depthStencil{{}, depthTest, depthTest, compOp};
+        vk::PipelineDepthStencilStateCreateInfo depthStencil{{}, depthTest, depthWrite, compOp};
 
         auto colorBlendAttachment = determineColorBlending(renderPassInfo.perPixelOperations);
         vk::PipelineColorBlendStateCreateInfo colorBlending{
@@ -799,16 +1203,24 @@ namespace tga
         bool vertexPresent{false};
         bool fragmentPresent{false};
         for (auto stage : renderPassInfo.shaderStages) {
-            const auto &shader = shaders[stage];
+            const auto &shader = shaders.at(stage);
             if (shader.type == ShaderType::compute) {
                 if (renderPassInfo.shaderStages.size() == 1) {
-                    return {
-                        device
-                            .createComputePipeline(
-                                {},
-                                {{}, {{}, vk::ShaderStageFlagBits::eCompute, shader.module, "main"}, pipelineLayout})
-                            .value,
-                        vk::PipelineBindPoint::eCompute};
+                    std::vector<vk::SpecializationMapEntry> mapEntries{};
+                    vk::SpecializationInfo specializationInfo{};
+                    auto pSpecializationInfo = determineSpecializationInfo(renderPassInfo, ShaderType::compute,
+                                                                           mapEntries, specializationInfo);
+                    return {device
+                                .createComputePipeline({},
+                                                       {{},
+                                                        {{},
+                                                         vk::ShaderStageFlagBits::eCompute,
+                                                         shader.module,
+                                                         "main",
+                                                         pSpecializationInfo},
+                                                        pipelineLayout})
+                                .value,
+                            vk::PipelineBindPoint::eCompute};
                 } else {
                     isValid = false;
                     break;
@@ -842,6 +1254,17 @@ namespace tga
         device.freeCommandBuffers(cmdPool, 1, &cmdBuffer);
     }
 
+    void TGAVulkan::updateOcclusionResults(QueryPool_TV &queryPool)
+    {
+        // Pairs of sample count and availability, queries still in flight or reset keep their previous count
+        std::vector<uint64_t> results(queryPool.queryCount * 2);
+        auto result = device.getQueryPoolResults(
+            queryPool.queryPool, 0, queryPool.queryCount, results.size() * sizeof(uint64_t), results.data(),
+            2 * sizeof(uint64_t), vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWithAvailability);
+        if (result != vk::Result::eSuccess && result != vk::Result::eNotReady) return;
+        for (uint32_t i = 0; i < queryPool.queryCount; i++)
+            if (results[2 * i + 1]) queryPool.samples[i] = results[2 * i];
+    }
     void TGAVulkan::fillBuffer(size_t size, const uint8_t *data, uint32_t offset, vk::Buffer target)
     {
         auto copyCmdBuffer = beginOneTimeCmdBuffer(transferCmdPool);
@@ -891,12 +1314,25 @@ namespace tga
                                     queueIndices.graphics,
                                     queueIndices.graphics,
                                     image,
-                                    {imageAspects, 0, 1, 0, VK_REMAINING_ARRAY_LAYERS}}});
+                                    {imageAspects, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS}}});
     }
 
     void TGAVulkan::fillTexture(size_t size, const uint8_t *data, vk::Extent3D extent, uint32_t layers,
-                                vk::Image target)
-    {
+                                vk::Image target, vk::Offset3D offset, uint32_t mipLevels)
+    {
+        // The levels are tightly packed, the texel size follows from the total size
+        std::vector<vk::Extent3D> levelExtents;
+        size_t texelCount = 0;
+        for (uint32_t level = 0; level < mipLevels; level++) {
+            levelExtents.push_back({std::max(extent.width >> level, 1u), std::max(extent.height >> level, 1u),
+                                    std::max(extent.depth >> level, 1u)});
+            auto &levelExtent = levelExtents.back();
+            texelCount += size_t(levelExtent.width) * levelExtent.height * levelExtent.depth * layers;
+        }
+        if (size % texelCount != 0)
+            throw std::runtime_error("[TGA Vulkan] Texture data does not match the size of its mip levels");
+        size_t texelSize = size / texelCount;
+
         auto buffer =
             allocateBuffer(size, vk::BufferUsageFlagBits::eTransferSrc,
                            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
@@ -904,8 +1340,15 @@ namespace tga
         std::memcpy(mapping, data, size);
         device.unmapMemory(buffer.memory);
         auto uploadCmd = beginOneTimeCmdBuffer(graphicsCmdPool);
-        vk::BufferImageCopy region{0, 0, 0, {vk::ImageAspectFlagBits::eColor, 0, 0, layers}, {0, 0, 0}, extent};
-        uploadCmd.copyBufferToImage(buffer.buffer, target, vk::ImageLayout::eTransferDstOptimal, {region});
+        std::vector<vk::BufferImageCopy> regions;
+        vk::DeviceSize bufferOffset = 0;
+        for (uint32_t level = 0; level < mipLevels; level++) {
+            auto &levelExtent = levelExtents[level];
+            regions.push_back(
+                {bufferOffset, 0, 0, {vk::ImageAspectFlagBits::eColor, level, 0, layers}, offset, levelExtent});
+            bufferOffset += texelSize * levelExtent.width * levelExtent.height * levelExtent.depth * layers;
+        }
+        uploadCmd.copyBufferToImage(buffer.buffer, target, vk::ImageLayout::eTransferDstOptimal, regions);
         endOneTimeCmdBuffer(uploadCmd, graphicsCmdPool, graphicsQueue);
         device.destroy(buffer.buffer);
         device.free(buffer.memory);
@@ -927,6 +1370,9 @@ namespace tga
         if (usage & tga::BufferUsage::storage) {
             usageFlags |= vk::BufferUsageFlagBits::eStorageBuffer;
         }
+        if (usage & tga::BufferUsage::indirect) {
+            usageFlags |= vk::BufferUsageFlagBits::eIndirectBuffer;
+        }
         return usageFlags;
     }
 
@@ -953,6 +1399,17 @@ namespace tga
             case Format::r8g8b8a8_srgb: return vk::Format::eR8G8B8A8Srgb;
             case Format::r8g8b8a8_unorm: return vk::Format::eR8G8B8A8Unorm;
             case Format::r8g8b8a8_snorm: return vk::Format::eR8G8B8A8Snorm;
+            case Format::r16_unorm: return vk::Format::eR16Unorm;
+            case Format::r16_snorm: return vk::Format::eR16Snorm;
+            case Format::r16_sfloat: return vk::Format::eR16Sfloat;
+            case Format::r16g16_unorm: return vk::Format::eR16G16Unorm;
+            case Format::r16g16_snorm: return vk::Format::eR16G16Snorm;
+            case Format::r16g16_sfloat: return vk::Format::eR16G16Sfloat;
+            case Format::r16g16b16a16_unorm: return vk::Format::eR16G16B16A16Unorm;
+            case Format::r16g16b16a16_snorm: return vk::Format::eR16G16B16A16Snorm;
+            case Format::r16g16b16a16_sfloat: return vk::Format::eR16G16B16A16Sfloat;
+            case Format::a2b10g10r10_unorm_pack32: return vk::Format::eA2B10G10R10UnormPack32;
+            case Format::a2b10g10r10_snorm_pack32: return vk::Format::eA2B10G10R10SnormPack32;
             case Format::r32_uint: return vk::Format::eR32Uint;
             case Format::r32_sint: return vk::Format::eR32Sint;
             case Format::r32_sfloat: return vk::Format::eR32Sfloat;
@@ -969,6 +1426,15 @@ namespace tga
         }
     }
 
+    vk::IndexType TGAVulkan::determineIndexType(tga::IndexType indexType)
+    {
+        switch (indexType) {
+            case IndexType::uint16: return vk::IndexType::eUint16;
+            case IndexType::uint32: return vk::IndexType::eUint32;
+            default: return vk::IndexType::eUint32;
+        }
+    }
+
     std::tuple<vk::Filter, vk::SamplerAddressMode> TGAVulkan::determineSamplerInfo(const TextureInfo &textureInfo)
     {
         auto filter = vk::Filter::eNearest;
@@ -983,6 +1449,23 @@ namespace tga
         return {filter, addressMode};
     }
 
+    vk::SpecializationInfo const *TGAVulkan::determineSpecializationInfo(
+        const RenderPassInfo &renderPassInfo, ShaderType stage, std::vector<vk::SpecializationMapEntry> &mapEntries,
+        vk::SpecializationInfo &specializationInfo)
+    {
+        for (auto &specialization : renderPassInfo.specializations) {
+            if (specialization.stage != stage) continue;
+            for (auto &constant : specialization.constants) {
+                if (constant.offset + constant.size > specialization.data.size())
+                    throw std::runtime_error("[TGA Vulkan] Specialization constant exceeds its data");
+                mapEntries.emplace_back(constant.id, constant.offset, constant.size);
+            }
+            specializationInfo = vk::SpecializationInfo{uint32_t(mapEntries.size()), mapEntries.data(),
+                                                        specialization.data.size(), specialization.data.data()};
+            return &specializationInfo;
+        }
+        return nullptr;
+    }
     vk::ShaderStageFlagBits TGAVulkan::determineShaderStage(tga::ShaderType shaderType)
     {
         switch (shaderType) {
@@ -1049,6 +1532,10 @@ namespace tga
         vk::BlendFactor dstBlendFac = determineBlendFactor(config.dstBlend);
         vk::BlendFactor srcAlphaBlendFac = determineBlendFactor(config.srcAlphaBlend);
         vk::BlendFactor dstAlphaBlendFac = determineBlendFactor(config.dstAlphaBlend);
+        vk::ColorComponentFlags writeMask{};
+        if (config.writeEnabled)
+            writeMask = vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
+                        vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
         return {enabled,
                 srcBlendFac,
                 dstBlendFac,
@@ -1056,8 +1543,7 @@ namespace tga
                 srcAlphaBlendFac,
                 dstAlphaBlendFac,
                 vk::BlendOp::eAdd,
-                vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB |
-                    vk::ColorComponentFlagBits::eA};
+                writeMask};
     }
 
     vk::DescriptorType TGAVulkan::determineDescriptorType(tga::BindingType bindingType)
@@ -4,6 +4,19 @@
 #include "tga/tga_utils.hpp"
 
 #include <filesystem>
+#include <optional>
+
+#include "glm/gtc/packing.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace tga
 {
@@ -12,17 +25,180 @@ namespace tga
         return {sizeof(Vertex), {{offsetof(Vertex, position), tga::Format::r32g32b32_sfloat}, {offsetof(Vertex, uv), tga::Format::r32g32_sfloat}, {offsetof(Vertex, normal), tga::Format::r32g32b32_sfloat}, {offsetof(Vertex, tangent), tga::Format::r32g32b32_sfloat}}};
     }
 
+    size_t IndexedMesh::indexCount() const
+    {
+        return indexType == IndexType::uint16 ? indexBuffer16.size() : indexBuffer.size();
+    }
+
+    uint32_t IndexedMesh::index(size_t i) const
+    {
+        return indexType == IndexType::uint16 ? indexBuffer16[i] : indexBuffer[i];
+    }
+
+    uint8_t const* IndexedMesh::indexData() const
+    {
+        if (indexType == IndexType::uint16) return reinterpret_cast<uint8_t const*>(indexBuffer16.data());
+        return reinterpret_cast<uint8_t const*>(indexBuffer.data());
+    }
+
+    size_t IndexedMesh::indexDataSize() const { return indexCount() * indexSize(indexType); }
+
+    VertexLayout PackedVertex::layout(PositionEncoding positionEncoding)
+    {
+        auto positionFormat = positionEncoding == PositionEncoding::unorm16 ? tga::Format::r16g16b16a16_unorm : tga::Format::r16g16b16a16_sfloat;
+        return {sizeof(PackedVertex), {{offsetof(PackedVertex, position), positionFormat}, {offsetof(PackedVertex, uv), tga::Format::r16g16_sfloat}, {offsetof(PackedVertex, normal), tga::Format::a2b10g10r10_snorm_pack32}, {offsetof(PackedVertex, tangent), tga::Format::r16g16_snorm}}};
+    }
+
+    glm::mat4 PackedObj::dequantization() const
+    {
+        if (positionEncoding == PositionEncoding::sfloat16) return glm::mat4(1);
+        return glm::scale(glm::translate(glm::mat4(1), boundsMin), boundsExtent);
+    }
+
+    // https://knarkowicz.wordpress.com/2014/04/16/octahedron-normal-vector-encoding/
+    glm::vec2 octahedralEncode(glm::vec3 n)
+    {
+        float l1 = glm::abs(n.x) + glm::abs(n.y) + glm::abs(n.z);
+        if (l1 == 0) return glm::vec2(0);
+        n /= l1;
+        glm::vec2 e{n.x, n.y};
+        if (n.z < 0) {
+            glm::vec2 signs{n.x >= 0 ? 1.f : -1.f, n.y >= 0 ? 1.f : -1.f};
+            e = (1.f - glm::abs(glm::vec2{n.y, n.x})) * signs;
+        }
+        return e;
+    }
+
+    glm::vec3 octahedralDecode(glm::vec2 e)
+    {
+        glm::vec3 n{e.x, e.y, 1.f - glm::abs(e.x) - glm::abs(e.y)};
+        float t = glm::max(-n.z, 0.f);
+        n.x += n.x >= 0 ? -t : t;
+        n.y += n.y >= 0 ? -t : t;
+        return glm::normalize(n);
+    }
+
+    PackedObj packObj(Obj const& obj, PositionEncoding positionEncoding)
+    {
+        PackedObj packed{};
+        packed.positionEncoding = positionEncoding;
+        packed.indexBuffer = obj.indexBuffer;
+        packed.indexBuffer16 = obj.indexBuffer16;
+        packed.indexType = obj.indexType;
+
+        glm::vec3 minPos{std::numeric_limits<float>::max()};
+        glm::vec3 maxPos{std::numeric_limits<float>::lowest()};
+        for (const auto& vertex : obj.vertexBuffer) {
+            minPos = glm::min(minPos, vertex.position);
+            maxPos = glm::max(maxPos, vertex.position);
+        }
+        if (obj.vertexBuffer.empty()) minPos = maxPos = glm::vec3(0);
+        packed.boundsMin = minPos;
+        // Flat meshes would divide by zero otherwise
+        packed.boundsExtent = glm::max(maxPos - minPos, glm::vec3(std::numeric_limits<float>::epsilon()));
+
+        packed.vertexBuffer.resize(obj.vertexBuffer.size());
+        for (size_t i = 0; i < obj.vertexBuffer.size(); i++) {
+            const auto& vertex = obj.vertexBuffer[i];
+            auto& target = packed.vertexBuffer[i];
+
+            uint64_t position;
+            if (positionEncoding == PositionEncoding::unorm16)
+                position = glm::packUnorm4x16(glm::vec4((vertex.position - packed.boundsMin) / packed.boundsExtent, 0));
+            else
+                position = glm::packHalf4x16(glm::vec4(vertex.position, 0));
+            std::memcpy(target.position, &position, sizeof(target.position));
+            uint32_t uv = glm::packHalf2x16(vertex.uv);
+            std::memcpy(target.uv, &uv, sizeof(target.uv));
+            target.normal = glm::packSnorm3x10_1x2(glm::vec4(glm::normalize(vertex.normal), 0));
+            uint32_t tangent = glm::packSnorm2x16(octahedralEncode(vertex.tangent));
+            std::memcpy(target.tangent, &tangent, sizeof(target.tangent));
+        }
+        return packed;
+    }
+
+    IndexType indexTypeFor(size_t vertexCount)
+    {
+        // Without primitive restart the full 16 bit range can be used as index
+        if (vertexCount <= size_t(std::numeric_limits<uint16_t>::max()) + 1) return IndexType::uint16;
+        return IndexType::uint32;
+    }
+
+    size_t indexSize(IndexType indexType)
+    {
+        return indexType == IndexType::uint16 ? sizeof(uint16_t) : sizeof(uint32_t);
+    }
+
+    namespace
+    {
+        // Read only view of a whole file, the OS pages it in on demand instead of copying it into a buffer
+        class MappedFile {
+        public:
+            MappedFile(std::string const& filepath)
+            {
+#ifdef _WIN32
+                file = CreateFileA(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                   FILE_ATTRIBUTE_NORMAL, nullptr);
+                if (file == INVALID_HANDLE_VALUE) throw std::runtime_error("[Error]: Failed to open file " + filepath);
+                LARGE_INTEGER fileSize;
+                if (!GetFileSizeEx(file, &fileSize)) fail("[Error]: Failed to stat file " + filepath);
+                size = size_t(fileSize.QuadPart);
+                // Neither Windows nor POSIX can map an empty file
+                if (size == 0) fail("[Error]: File is empty " + filepath);
+                mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+                if (mapping) data = static_cast<uint8_t const*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+                file = open(filepath.c_str(), O_RDONLY);
+                if (file < 0) throw std::runtime_error("[Error]: Failed to open file " + filepath);
+                struct stat fileStat;
+                if (fstat(file, &fileStat) != 0) fail("[Error]: Failed to stat file " + filepath);
+                size = size_t(fileStat.st_size);
+                if (size == 0) fail("[Error]: File is empty " + filepath);
+                void* view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+                if (view != MAP_FAILED) data = static_cast<uint8_t const*>(view);
+#endif
+                if (!data) fail("[Error]: Failed to map file " + filepath);
+            }
+            MappedFile(MappedFile const&) = delete;
+            MappedFile& operator=(MappedFile const&) = delete;
+            ~MappedFile() { release(); }
+
+            uint8_t const* data = nullptr;
+            size_t size = 0;
+
+        private:
+            // The destructor does not run for a throwing constructor, so it cleans up itself
+            [[noreturn]] void fail(std::string const& message)
+            {
+                release();
+                throw std::runtime_error(message);
+            }
+
+            void release()
+            {
+#ifdef _WIN32
+                if (data) UnmapViewOfFile(data);
+                if (mapping) CloseHandle(mapping);
+                CloseHandle(file);
+#else
+                if (data) munmap(const_cast<uint8_t*>(data), size);
+                close(file);
+#endif
+            }
+
+#ifdef _WIN32
+            HANDLE file = INVALID_HANDLE_VALUE;
+            HANDLE mapping = nullptr;
+#else
+            int file = -1;
+#endif
+        };
+    }  // namespace
+
     Shader loadShader(std::string const& filepath, ShaderType shaderType, std::shared_ptr<Interface> const& tgai)
     {
-        std::ifstream file(filepath, std::ios::binary);
-        if (!file.is_open())
-            throw std::runtime_error("[Error]: Failed to open file " + filepath);
-        auto fileSize = std::filesystem::file_size(filepath);
-        std::vector<char> data;
-        data.resize(fileSize);
-        file.read(data.data(), fileSize);
-        file.close();
-        return tgai->createShader({shaderType, (uint8_t*)data.data(), data.size()});
+        MappedFile file(filepath);
+        return tgai->createShader({shaderType, file.data, file.size});
     }
 
     int formatComponentCount(Format format)
@@ -33,6 +209,9 @@ namespace tga
             case Format::r8_srgb:
             case Format::r8_unorm:
             case Format::r8_snorm:
+            case Format::r16_unorm:
+            case Format::r16_snorm:
+            case Format::r16_sfloat:
             case Format::r32_uint:
             case Format::r32_sint:
             case Format::r32_sfloat:
@@ -42,6 +221,9 @@ namespace tga
             case Format::r8g8_srgb:
             case Format::r8g8_unorm:
             case Format::r8g8_snorm:
+            case Format::r16g16_unorm:
+            case Format::r16g16_snorm:
+            case Format::r16g16_sfloat:
             case Format::r32g32_uint:
             case Format::r32g32_sint:
             case Format::r32g32_sfloat:
@@ -60,6 +242,11 @@ namespace tga
             case Format::r8g8b8a8_srgb:
             case Format::r8g8b8a8_unorm:
             case Format::r8g8b8a8_snorm:
+            case Format::r16g16b16a16_unorm:
+            case Format::r16g16b16a16_snorm:
+            case Format::r16g16b16a16_sfloat:
+            case Format::a2b10g10r10_unorm_pack32:
+            case Format::a2b10g10r10_snorm_pack32:
             case Format::r32g32b32a32_uint:
             case Format::r32g32b32a32_sint:
             case Format::r32g32b32a32_sfloat:
@@ -80,6 +267,28 @@ namespace tga
         }
     }
 
+    bool isHalfFloatFormat(Format format)
+    {
+        switch (format) {
+            case Format::r16_sfloat:
+            case Format::r16g16_sfloat:
+            case Format::r16g16b16a16_sfloat:
+                return true;
+            default: return false;
+        }
+    }
+
+    bool isUnorm16Format(Format format)
+    {
+        switch (format) {
+            case Format::r16_unorm:
+            case Format::r16g16_unorm:
+            case Format::r16g16b16a16_unorm:
+                return true;
+            default: return false;
+        }
+    }
+
     TextureBundle loadTexture(std::string const& filepath, Format format, SamplerMode samplerMode, std::shared_ptr<Interface> const& tgai, bool doGammaCorrection)
     {
         int width, height, channels;
@@ -87,7 +296,8 @@ namespace tga
         uint8_t* data;
         uint32_t dataSize = 0;
 
-        if (isFloatingPointFormat(format)) {
+        std::vector<uint16_t> halfData;
+        if (isFloatingPointFormat(format) || isHalfFloatFormat(format)) {
             // Usually, we don't want any conversion when loading hdr files
             float currentGamma = 1 / stbi__l2h_gamma;
             if (stbi_is_hdr(filepath.c_str()) && !doGammaCorrection)
@@ -97,6 +307,13 @@ namespace tga
             dataSize = width * height * components * sizeof(float);
 
             stbi_hdr_to_ldr_gamma(currentGamma);
+        } else if (isUnorm16Format(format)) {
+            data = reinterpret_cast<uint8_t*>(stbi_load_16(filepath.c_str(), &width, &height, &channels, components));
+            dataSize = width * height * components * sizeof(uint16_t);
+        } else if (format == Format::a2b10g10r10_unorm_pack32 || format == Format::a2b10g10r10_snorm_pack32 ||
+                   format == Format::r16_snorm || format == Format::r16g16_snorm ||
+                   format == Format::r16g16b16a16_snorm) {
+            throw std::runtime_error("[TGA] Utils: Format not supported for loading image files: " + filepath);
         } else {
             data = reinterpret_cast<uint8_t*>(stbi_load(filepath.c_str(), &width, &height, &channels, components));
             dataSize = width * height * components * sizeof(uint8_t);
@@ -105,10 +322,19 @@ namespace tga
         if (!data)
             throw std::runtime_error("[TGA] Utils: Can't load image: " + filepath);
 
+        uint8_t const* uploadData = data;
+        if (isHalfFloatFormat(format)) {
+            auto floatData = reinterpret_cast<float const*>(data);
+            halfData.resize(width * height * components);
+            for (size_t i = 0; i < halfData.size(); i++) halfData[i] = glm::packHalf1x16(floatData[i]);
+            uploadData = reinterpret_cast<uint8_t const*>(halfData.data());
+            dataSize = halfData.size() * sizeof(uint16_t);
+        }
+
         auto texture = tgai->createTexture({static_cast<uint32_t>(width),
                                             static_cast<uint32_t>(height),
                                             format,
-                                            data, dataSize,
+                                            uploadData, dataSize,
                                             samplerMode});
 
         stbi_image_free(data);
@@ -156,7 +382,222 @@ namespace tga
         return image;
     }
 
-    Obj loadObj(std::string const& filepath)
+    namespace
+    {
+        // Calls body(first, last) on bands of [0, count) on all cores, small workloads stay on this thread
+        template <typename Body>
+        void parallelRows(uint32_t count, size_t workPerRow, Body const& body)
+        {
+            size_t threads = std::max(std::thread::hardware_concurrency(), 1u);
+            size_t bands = std::clamp<size_t>(count * workPerRow / 65536, 1, std::min<size_t>(threads, count));
+            std::vector<std::future<void>> others;
+            for (size_t band = 1; band < bands; band++)
+                others.push_back(std::async(std::launch::async, [&body, count, bands, band] {
+                    body(uint32_t(count * band / bands), uint32_t(count * (band + 1) / bands));
+                }));
+            body(0, uint32_t(count / bands));
+            for (auto& other : others) other.get();
+        }
+
+        /**
+         * Source texels and weights of every target texel along one axis, `stride` taps per target texel. Unused
+         * taps of a footprint have a weight of zero
+         */
+        struct AxisTaps {
+            uint32_t stride;
+            std::vector<uint32_t> indices;
+            std::vector<float> weights;
+        };
+
+        // Modified Bessel function of the first kind and order zero, power series
+        double besselI0(double x)
+        {
+            double sum = 1, term = 1;
+            for (int k = 1; k < 32; k++) {
+                term *= (x / (2 * k)) * (x / (2 * k));
+                sum += term;
+            }
+            return sum;
+        }
+
+        AxisTaps axisTaps(uint32_t source, uint32_t target, MipFilter filter)
+        {
+            AxisTaps taps{};
+            if (filter == MipFilter::kaiser && source > 1) {
+                // Sinc of the target frequency over three target texels to either side, clamped at the edges
+                constexpr double radius = 3, alpha = 4;
+                double scale = double(source) / target;
+                taps.stride = uint32_t(2 * std::ceil(radius * scale)) + 1;
+                std::vector<double> weights(taps.stride);
+                for (uint32_t t = 0; t < target; t++) {
+                    double center = (t + .5) * scale - .5;
+                    int64_t first = int64_t(std::ceil(center - radius * scale));
+                    double total = 0;
+                    for (uint32_t k = 0; k < taps.stride; k++) {
+                        int64_t s = first + k;
+                        double d = (double(s) - center) / scale;
+                        double weight = 0;
+                        if (std::abs(d) < radius) {
+                            double sinc = d == 0 ? 1 : std::sin(glm::pi<double>() * d) / (glm::pi<double>() * d);
+                            weight = sinc * besselI0(alpha * std::sqrt(1 - (d / radius) * (d / radius))) /
+                                     besselI0(alpha);
+                        }
+                        taps.indices.push_back(uint32_t(std::clamp<int64_t>(s, 0, source - 1)));
+                        weights[k] = weight;
+                        total += weight;
+                    }
+                    for (double weight : weights) taps.weights.push_back(float(weight / total));
+                }
+            } else if (source == 1) {
+                taps = {1, {0}, {1}};
+            } else if (source % 2 == 0) {
+                taps.stride = 2;
+                for (uint32_t t = 0; t < target; t++) {
+                    taps.indices.insert(taps.indices.end(), {2 * t, 2 * t + 1});
+                    taps.weights.insert(taps.weights.end(), {.5f, .5f});
+                }
+            } else {
+                // Odd sizes: every target texel covers 2 + 1 / target source texels, the weights are the overlaps
+                taps.stride = 3;
+                float n = float(target);
+                for (uint32_t t = 0; t < target; t++) {
+                    taps.indices.insert(taps.indices.end(), {2 * t, 2 * t + 1, 2 * t + 2});
+                    taps.weights.insert(taps.weights.end(),
+                                        {(n - t) / source, n / source, (t + 1.f) / source});
+                }
+            }
+            return taps;
+        }
+
+        // Separable reduction: the taps of a row are first combined over whole source rows, which is contiguous
+        // and vectorizes, then along the row
+        void reduceLevel(float const* source, uint32_t sourceWidth, uint32_t sourceHeight, float* target,
+                         uint32_t targetWidth, uint32_t targetHeight, uint32_t components, MipFilter filter)
+        {
+            MipFilter footprint = filter == MipFilter::kaiser ? MipFilter::kaiser : MipFilter::box;
+            AxisTaps columns = axisTaps(sourceWidth, targetWidth, footprint);
+            AxisTaps rows = axisTaps(sourceHeight, targetHeight, footprint);
+            size_t rowSize = size_t(sourceWidth) * components;
+            parallelRows(targetHeight, rowSize * rows.stride, [&](uint32_t first, uint32_t last) {
+                std::vector<float> line(rowSize);
+                float* combined = line.data();
+                for (uint32_t y = first; y < last; y++) {
+                    for (uint32_t k = 0; k < rows.stride; k++) {
+                        float const* row = source + rows.indices[y * rows.stride + k] * rowSize;
+                        float weight = rows.weights[y * rows.stride + k];
+                        if (k == 0 && (filter == MipFilter::min || filter == MipFilter::max)) {
+                            std::copy_n(row, rowSize, combined);
+                        } else if (k == 0) {
+                            for (size_t i = 0; i < rowSize; i++) combined[i] = weight * row[i];
+                        } else if (filter == MipFilter::min) {
+                            for (size_t i = 0; i < rowSize; i++) combined[i] = std::min(combined[i], row[i]);
+                        } else if (filter == MipFilter::max) {
+                            for (size_t i = 0; i < rowSize; i++) combined[i] = std::max(combined[i], row[i]);
+                        } else {
+                            for (size_t i = 0; i < rowSize; i++) combined[i] += weight * row[i];
+                        }
+                    }
+
+                    float* out = target + size_t(y) * targetWidth * components;
+                    if (filter == MipFilter::box && columns.stride == 2) {
+                        // Even widths, the common case, pairs of neighbouring texels without the tap tables
+                        size_t outSize = size_t(targetWidth) * components;
+                        for (size_t i = 0; i < outSize; i++) {
+                            size_t left = (i / components) * 2 * components + i % components;
+                            out[i] = .5f * (combined[left] + combined[left + components]);
+                        }
+                        continue;
+                    }
+                    for (uint32_t x = 0; x < targetWidth; x++) {
+                        uint32_t const* indices = &columns.indices[x * columns.stride];
+                        float const* weights = &columns.weights[x * columns.stride];
+                        for (uint32_t c = 0; c < components; c++) {
+                            float value = combined[indices[0] * components + c];
+                            if (filter == MipFilter::min || filter == MipFilter::max) {
+                                for (uint32_t k = 1; k < columns.stride; k++) {
+                                    float next = combined[indices[k] * components + c];
+                                    value = filter == MipFilter::min ? std::min(value, next) : std::max(value, next);
+                                }
+                            } else {
+                                value *= weights[0];
+                                for (uint32_t k = 1; k < columns.stride; k++)
+                                    value += weights[k] * combined[indices[k] * components + c];
+                            }
+                            out[x * components + c] = value;
+                        }
+                    }
+                }
+            });
+        }
+
+        template <typename T>
+        MipChain<T> allocateMipChain(uint32_t width, uint32_t height, uint32_t components, size_t dataSize,
+                                     uint32_t levels)
+        {
+            if (width == 0 || height == 0 || dataSize != size_t(width) * height * components)
+                throw std::runtime_error("[TGA] Utils: Image data does not match its dimensions");
+            uint32_t fullChain = 1;
+            while ((std::max(width, height) >> fullChain) > 0) fullChain++;
+            levels = levels == 0 ? fullChain : std::min(levels, fullChain);
+
+            MipChain<T> chain{width, height, components, {}, {}};
+            size_t size = 0;
+            for (uint32_t level = 0; level < levels; level++) {
+                chain.offsets.push_back(size);
+                size += size_t(chain.levelWidth(level)) * chain.levelHeight(level) * components;
+            }
+            chain.data.resize(size);
+            return chain;
+        }
+
+        float srgbToLinear(float value)
+        {
+            return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+        }
+
+        float linearToSrgb(float value)
+        {
+            return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1 / 2.4f) - 0.055f;
+        }
+    }  // namespace
+
+    MipChain<float> buildMipChain(HDRImage const& image, MipFilter filter, uint32_t levels)
+    {
+        auto chain = allocateMipChain<float>(image.width, image.height, image.components, image.data.size(), levels);
+        std::copy(image.data.begin(), image.data.end(), chain.data.begin());
+        // Every level is reduced from the previous one, not from the image
+        for (uint32_t level = 1; level < chain.levelCount(); level++)
+            reduceLevel(chain.data.data() + chain.offsets[level - 1], chain.levelWidth(level - 1),
+                        chain.levelHeight(level - 1), chain.data.data() + chain.offsets[level], chain.levelWidth(level),
+                        chain.levelHeight(level), chain.components, filter);
+        return chain;
+    }
+
+    MipChain<uint8_t> buildMipChain(Image const& image, MipFilter filter, bool srgb, uint32_t levels)
+    {
+        auto result = allocateMipChain<uint8_t>(image.width, image.height, image.components, image.data.size(), levels);
+        bool hasAlpha = image.components == 2 || image.components == 4;
+        auto isColor = [&](size_t i) { return srgb && !(hasAlpha && i % image.components == image.components - 1); };
+
+        std::array<float, 256> srgbTable;
+        for (uint32_t i = 0; i < 256; i++) srgbTable[i] = srgbToLinear(i / 255.f);
+
+        HDRImage linear{image.width, image.height, image.components, std::vector<float>(image.data.size())};
+        for (size_t i = 0; i < image.data.size(); i++)
+            linear.data[i] = isColor(i) ? srgbTable[image.data[i]] : image.data[i] / 255.f;
+        auto chain = buildMipChain(linear, filter, result.levelCount());
+
+        // Level 0 stays bit exact, the others are quantized once from float
+        std::copy(image.data.begin(), image.data.end(), result.data.begin());
+        for (size_t i = image.data.size(); i < chain.data.size(); i++) {
+            float value = std::clamp(chain.data[i], 0.f, 1.f);
+            if (isColor(i)) value = linearToSrgb(value);
+            result.data[i] = uint8_t(value * 255 + .5f);
+        }
+        return result;
+    }
+
+    Obj loadObj(std::string const& filepath, bool allowShortIndices)
     {
         // Using tinyobjloader to get the data
         tinyobj::attrib_t attrib;
@@ -229,7 +670,17 @@ namespace tga
         for (auto& vertex : vertexBuffer)
             vertex.tangent = glm::normalize(vertex.tangent);
 
-        return {vertexBuffer, indexBuffer};
+        Obj obj{};
+        obj.vertexBuffer = std::move(vertexBuffer);
+        if (allowShortIndices && indexTypeFor(obj.vertexBuffer.size()) == IndexType::uint16) {
+            // Halves the index memory and the index fetch bandwidth
+            obj.indexType = IndexType::uint16;
+            obj.indexBuffer16.assign(indexBuffer.begin(), indexBuffer.end());
+        } else {
+            obj.indexType = IndexType::uint32;
+            obj.indexBuffer = std::move(indexBuffer);
+        }
+        return obj;
     }
 
     void writeHDR(std::string const& filename, uint32_t width, uint32_t height, tga::Format format, std::vector<float> const& data)
@@ -261,4 +712,319 @@ namespace tga
         if (!stbi_write_png(filename.c_str(), static_cast<int>(width), static_cast<int>(height), components, data.data(), 0))
             std::cerr << "[TGA] Warning: File " << filename << " could not be saved to disk\n";
     }
+
+    namespace
+    {
+        std::shared_ptr<Interface> lockInterface(std::weak_ptr<Interface> const& tgai)
+        {
+            auto instance = tgai.lock();
+            if (!instance) throw std::runtime_error("[TGA] Utils: AssetCache used after its Interface was destroyed");
+            return instance;
+        }
+    }  // namespace
+
+    AssetCache::AssetCache(std::shared_ptr<tga::Interface> const& _tgai) : tgai(_tgai) {}
+
+    std::shared_ptr<TextureBundle const> AssetCache::texture(std::string const& filepath, Format format,
+                                                             SamplerMode samplerMode, bool doGammaCorrection)
+    {
+        auto key = "texture|" + std::to_string(int(format)) + "|" + std::to_string(int(samplerMode)) + "|" +
+                   std::to_string(doGammaCorrection) + "|" + filepath;
+        return std::static_pointer_cast<TextureBundle const>(acquire(key, [&]() -> Asset {
+            auto bundle = loadTexture(filepath, format, samplerMode, lockInterface(tgai), doGammaCorrection);
+            return std::shared_ptr<TextureBundle const>(new TextureBundle(bundle),
+                                                        [weak = tgai](TextureBundle const* bundle) {
+                                                            if (auto instance = weak.lock())
+                                                                instance->free(bundle->texture);
+                                                            delete bundle;
+                                                        });
+        }));
+    }
+
+    std::shared_ptr<Shader const> AssetCache::shader(std::string const& filepath, ShaderType shaderType)
+    {
+        auto key = "shader|" + std::to_string(int(shaderType)) + "|" + filepath;
+        return std::static_pointer_cast<Shader const>(acquire(key, [&]() -> Asset {
+            auto shader = loadShader(filepath, shaderType, lockInterface(tgai));
+            return std::shared_ptr<Shader const>(new Shader(shader), [weak = tgai](Shader const* shader) {
+                if (auto instance = weak.lock()) instance->free(*shader);
+                delete shader;
+            });
+        }));
+    }
+
+    std::shared_ptr<Obj const> AssetCache::obj(std::string const& filepath, bool allowShortIndices)
+    {
+        auto key = "obj|" + std::to_string(allowShortIndices) + "|" + filepath;
+        return std::static_pointer_cast<Obj const>(
+            acquire(key, [&]() -> Asset { return std::make_shared<Obj const>(loadObj(filepath, allowShortIndices)); }));
+    }
+
+    AssetCache::Asset AssetCache::acquire(std::string const& key, std::function<Asset()> const& load)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto& entry = entries[key];
+        if (auto asset = entry.asset.lock()) return asset;
+        if (entry.loading.valid()) {
+            // Somebody else is loading it, wait outside of the lock so other assets can be requested meanwhile
+            auto loading = entry.loading;
+            lock.unlock();
+            return loading.get();
+        }
+
+        std::promise<Asset> promise;
+        entry.loading = promise.get_future().share();
+        lock.unlock();
+
+        Asset asset;
+        try {
+            asset = load();
+        } catch (...) {
+            // Waiting requests get the error, the next request tries again
+            lock.lock();
+            entries.erase(key);
+            lock.unlock();
+            promise.set_exception(std::current_exception());
+            throw;
+        }
+
+        lock.lock();
+        // Entries of released assets would pile up otherwise, loads are rare enough for a full sweep
+        for (auto it = entries.begin(); it != entries.end();) {
+            if (!it->second.loading.valid() && it->second.asset.expired())
+                it = entries.erase(it);
+            else
+                ++it;
+        }
+        auto& loaded = entries[key];
+        loaded.asset = asset;
+        loaded.loading = {};
+        lock.unlock();
+        promise.set_value(asset);
+        return asset;
+    }
+
+    uint32_t DrawBatch::add(MeshRange const& range, uint32_t instanceCount)
+    {
+        uint32_t firstInstance = instances;
+        add(range, instanceCount, firstInstance);
+        return firstInstance;
+    }
+
+    void DrawBatch::add(MeshRange const& range, uint32_t instanceCount, uint32_t firstInstance)
+    {
+        if (indirectBuffer) throw std::runtime_error("[TGA] Utils: DrawBatch can't grow after upload");
+        commands.push_back(
+            {range.indexCount, instanceCount, range.firstIndex, int32_t(range.vertexOffset), firstInstance});
+        instances = std::max(instances, firstInstance + instanceCount);
+    }
+
+    void DrawBatch::upload(std::shared_ptr<tga::Interface> const& tgai)
+    {
+        // Without indirect firstInstance the draws are issued one by one from the CPU side copy
+        indirect = tgai->indirectFirstInstanceSupported();
+        if (!indirect || commands.empty()) return;
+        indirectBuffer = tgai->createBuffer(
+            {BufferUsage::indirect, memoryAccess(commands), commands.size() * sizeof(DrawIndexedIndirectCommand)});
+    }
+
+    void DrawBatch::draw(std::shared_ptr<tga::Interface> const& tgai) const
+    {
+        if (indirect) {
+            if (indirectBuffer) tgai->drawIndexedIndirect(indirectBuffer, uint32_t(commands.size()));
+            return;
+        }
+        for (auto const& command : commands)
+            tgai->drawIndexed(command.indexCount, command.firstIndex, uint32_t(command.vertexOffset),
+                              command.instanceCount, command.firstInstance);
+    }
+
+    void DrawBatch::free(std::shared_ptr<tga::Interface> const& tgai)
+    {
+        if (indirectBuffer) tgai->free(indirectBuffer);
+        indirectBuffer = tga::Buffer();
+    }
+
+    namespace
+    {
+        uint32_t pageKey(VirtualPage page) { return page.level << 24 | page.y << 12 | page.x; }
+
+        VirtualPage pageFromKey(uint32_t key) { return {key >> 24, (key >> 12) & 0xfff, key & 0xfff}; }
+
+        bool isPowerOfTwo(uint32_t value) { return value && !(value & (value - 1)); }
+    }  // namespace
+
+    VirtualTexture::VirtualTexture(std::shared_ptr<tga::Interface> const& _tgai, VirtualTextureInfo const& info,
+                                   uint32_t windowWidth, uint32_t windowHeight, PageLoader _loader)
+        : tgai(_tgai), uploadsPerFrame(info.uploadsPerFrame), loader(std::move(_loader))
+    {
+        if (!isPowerOfTwo(info.size) || !isPowerOfTwo(info.contentSize) || info.contentSize > info.size)
+            throw std::runtime_error("[TGA] Utils: Virtual texture and page sizes must be powers of two");
+        uint32_t pagesPerSide = info.size / info.contentSize;
+        if (pagesPerSide > 4096) throw std::runtime_error("[TGA] Utils: Virtual texture has too many pages per side");
+        if (info.cachePages == 0) throw std::runtime_error("[TGA] Utils: Virtual texture cache can't be empty");
+
+        uint32_t levels = 1;
+        while ((pagesPerSide >> (levels - 1)) > 1) levels++;
+        parameters = {info.size, info.contentSize, info.border, levels, info.cachePages,
+                      info.contentSize + 2 * info.border};
+
+        uint32_t pageCount = 0;
+        for (uint32_t level = 0; level < levels; ++level) {
+            levelOffsets.push_back(pageCount);
+            pageCount += (pagesPerSide >> level) * (pagesPerSide >> level);
+        }
+        pageTableData.resize(pageCount, 0);
+        slots.resize(info.cachePages * info.cachePages, {0, 0, false});
+
+        uint32_t cacheSize = info.cachePages * parameters.pageSize;
+        cache = tgai->createTexture({cacheSize, cacheSize, Format::r8g8b8a8_unorm, nullptr, 0, SamplerMode::linear});
+        pageTable = tgai->createBuffer(
+            {BufferUsage::storage, memoryAccess(pageTableData), pageTableData.size() * sizeof(uint32_t)});
+        parameterBuffer = tgai->createBuffer({BufferUsage::uniform, memoryAccess(parameters), sizeof(parameters)});
+
+        uint32_t feedbackScale = std::max(info.feedbackScale, 1u);
+        feedbackWidth = std::max(windowWidth / feedbackScale, 1u);
+        feedbackHeight = std::max(windowHeight / feedbackScale, 1u);
+        feedback = tgai->createTexture({feedbackWidth, feedbackHeight, Format::r32_uint});
+
+        // The coarsest page is the fallback of every lookup, it is loaded up front and never evicted
+        uint32_t root = pageKey({levels - 1, 0, 0});
+        std::vector<uint8_t> texels(size_t(parameters.pageSize) * parameters.pageSize * 4);
+        loader(pageFromKey(root), texels);
+        upload(root, texels, 0);
+        slots[0].lastUsed = std::numeric_limits<uint64_t>::max();
+        tgai->updateBuffer(pageTable, memoryAccess(pageTableData), pageTableData.size() * sizeof(uint32_t), 0);
+
+        loaderThread = std::thread(&VirtualTexture::loaderLoop, this);
+    }
+
+    VirtualTexture::~VirtualTexture()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopLoader = true;
+        }
+        wakeLoader.notify_all();
+        loaderThread.join();
+        tgai->free(cache);
+        tgai->free(pageTable);
+        tgai->free(parameterBuffer);
+        tgai->free(feedback);
+    }
+
+    void VirtualTexture::readFeedback()
+    {
+        auto texels = tgai->readback(feedback);
+        frame++;
+
+        // Only width * height entries are meaningful, the readback may be padded
+        auto entries = reinterpret_cast<uint32_t const*>(texels.data());
+        size_t entryCount = std::min(size_t(feedbackWidth) * feedbackHeight, texels.size() / sizeof(uint32_t));
+        uint32_t pagesPerSide = parameters.size / parameters.contentSize;
+        std::unordered_set<uint32_t> wanted;
+        for (size_t i = 0; i < entryCount; ++i) {
+            if (entries[i] == 0) continue;
+            auto page = pageFromKey(entries[i] - 1);
+            if (page.level >= parameters.levelCount || page.x >= (pagesPerSide >> page.level) ||
+                page.y >= (pagesPerSide >> page.level))
+                continue;
+            // The parents are wanted as well so missing pages degrade one level at a time
+            while (wanted.insert(pageKey(page)).second && page.level + 1 < parameters.levelCount)
+                page = {page.level + 1, page.x / 2, page.y / 2};
+        }
+
+        std::vector<uint32_t> missing;
+        for (auto key : wanted) {
+            if (auto resident = residentSlots.find(key); resident != residentSlots.end()) {
+                auto& slot = slots[resident->second];
+                slot.lastUsed = std::max(slot.lastUsed, frame);
+            } else {
+                missing.push_back(key);
+            }
+        }
+        // Finest first so that the coarsest page ends up at the back, where the loader takes from
+        std::sort(missing.begin(), missing.end(), [](uint32_t a, uint32_t b) { return (a >> 24) < (b >> 24); });
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            // Requests that did not start loading yet are replaced, the view may have moved on
+            for (auto key : requests) pending.erase(key);
+            requests.clear();
+            for (auto key : missing)
+                if (pending.insert(key).second) requests.push_back(key);
+        }
+        wakeLoader.notify_one();
+    }
+
+    void VirtualTexture::update()
+    {
+        std::vector<LoadedPage> pages;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            size_t count = std::min<size_t>(loaded.size(), uploadsPerFrame);
+            pages.assign(std::make_move_iterator(loaded.end() - count), std::make_move_iterator(loaded.end()));
+            loaded.resize(loaded.size() - count);
+            for (auto const& page : pages) pending.erase(page.key);
+        }
+
+        bool dirty = false;
+        for (auto const& page : pages) {
+            if (residentSlots.count(page.key)) continue;
+            // Least recently used slot, pages seen by the latest feedback are never evicted
+            std::optional<uint32_t> victim;
+            for (uint32_t i = 0; i < slots.size(); ++i) {
+                if (!slots[i].occupied) {
+                    victim = i;
+                    break;
+                }
+                if (slots[i].lastUsed < frame && (!victim || slots[i].lastUsed < slots[*victim].lastUsed))
+                    victim = i;
+            }
+            // The cache is full of visible pages, the rest is requested again by the next feedback
+            if (!victim) break;
+            if (slots[*victim].occupied) {
+                pageTableData[pageIndex(slots[*victim].key)] = 0;
+                residentSlots.erase(slots[*victim].key);
+            }
+            upload(page.key, page.texels, *victim);
+            dirty = true;
+        }
+        if (dirty)
+            tgai->updateBuffer(pageTable, memoryAccess(pageTableData), pageTableData.size() * sizeof(uint32_t), 0);
+    }
+
+    uint32_t VirtualTexture::pageIndex(uint32_t key) const
+    {
+        auto page = pageFromKey(key);
+        uint32_t levelPages = (parameters.size / parameters.contentSize) >> page.level;
+        return levelOffsets[page.level] + page.y * levelPages + page.x;
+    }
+
+    void VirtualTexture::upload(uint32_t key, std::vector<uint8_t> const& texels, uint32_t slot)
+    {
+        uint32_t x = slot % parameters.cachePages * parameters.pageSize;
+        uint32_t y = slot / parameters.cachePages * parameters.pageSize;
+        tgai->updateTexture(cache, texels.data(), texels.size(), x, y, parameters.pageSize, parameters.pageSize);
+        slots[slot] = {key, frame, true};
+        residentSlots[key] = slot;
+        pageTableData[pageIndex(key)] = slot + 1;
+    }
+
+    void VirtualTexture::loaderLoop()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wakeLoader.wait(lock, [this] { return stopLoader || !requests.empty(); });
+            if (stopLoader) return;
+            uint32_t key = requests.back();
+            requests.pop_back();
+
+            lock.unlock();
+            std::vector<uint8_t> texels(size_t(parameters.pageSize) * parameters.pageSize * 4);
+            loader(pageFromKey(key), texels);
+            lock.lock();
+            loaded.push_back({key, std::move(texels)});
+        }
+    }
 }  // namespace tga
\ No newline at end of file